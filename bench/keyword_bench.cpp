@@ -0,0 +1,426 @@
+//Benchmarks the keyword set and map backends against each other, on generated
+//keys of several shapes and sizes.
+//
+//Build and run from this directory with
+//    g++ -std=c++17 -O2 -march=native -I.. keyword_bench.cpp ../src/keyword_trie.cpp ../src/keyword_image.cpp ../src/file_parser.cpp ../src/char_utils.cpp -o keyword_bench
+//    ./keyword_bench [max_keys]
+//
+//The sets have 10, 1000, 100000, 1000000 and 10000000 keys, up to max_keys
+//(by default 1000000; 10000000 needs a few GB of memory). For every shape,
+//size and backend, it reports the build time (for mapped images, the time to
+//open one), the memory per key (heap bytes still allocated after building, or
+//the size of the image), the time per match_whole, alone and in batches where
+//a backend has them, and its latency percentiles (half of the strings are
+//keys, the others keys with one byte changed), the time per positional match,
+//and the throughput of finding all keywords in a text. Backends without a
+//scanner find them by matching at every position in turn.
+//
+//"length buckets" is the layout keyword_set had before it was a prefix tree:
+//an unordered_set of the keywords of each length, tried longest first.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <malloc.h>
+
+#include "../keyword_set.hpp"
+#include "../keyword_map.hpp"
+#include "../keyword_image.hpp"
+
+//Keep track of the heap memory in use, as malloc counts it. The replacements
+//are not inlined, as GCC would then see free() called on memory from new and
+//warn (-Wmismatched-new-delete), although they are paired here.
+static std::atomic<size_t> live_bytes(0);
+
+__attribute__((noinline)) void* operator new(size_t size){
+    if(void* ptr = std::malloc(size ? size : 1)){
+        live_bytes += malloc_usable_size(ptr);
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* ptr) noexcept {
+    live_bytes -= malloc_usable_size(ptr);
+    std::free(ptr);
+}
+__attribute__((noinline)) void operator delete(void* ptr, size_t) noexcept {
+    live_bytes -= malloc_usable_size(ptr);
+    std::free(ptr);
+}
+__attribute__((noinline)) void* operator new(size_t size, std::align_val_t align){
+    if(void* ptr = std::aligned_alloc(size_t(align), (size + size_t(align) - 1) / size_t(align) * size_t(align))){
+        live_bytes += malloc_usable_size(ptr);
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* ptr, std::align_val_t) noexcept {
+    live_bytes -= malloc_usable_size(ptr);
+    std::free(ptr);
+}
+__attribute__((noinline)) void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    live_bytes -= malloc_usable_size(ptr);
+    std::free(ptr);
+}
+
+using bench_clock = std::chrono::steady_clock;
+
+namespace {
+
+    const char* image_file = "keyword_bench.img";
+
+    //The keyword_set of old, without its bugs
+    class length_buckets {
+    private:
+        std::map< size_t, std::unordered_set<std::string>, std::greater<size_t> > set;
+
+    public:
+        void insert(const std::string& key){ set[key.length()].insert(key); }
+
+        size_t match(std::string_view str, size_t pos) const {
+            for(auto it = set.lower_bound(str.length() - pos); it != set.end(); ++it){
+                if(it->second.count(std::string(str.substr(pos, it->first))))
+                    return it->first;
+            }
+            return std::string::npos;
+        }
+
+        size_t match_whole(std::string_view str) const {
+            auto it = set.find(str.length());
+            return it != set.end() && it->second.count(std::string(str)) ? str.length() : std::string::npos;
+        }
+    };
+
+    struct workload {
+        std::vector<std::string> keys;
+        std::vector<std::string> queries;       //for match_whole
+        std::vector<std::string> lines;         //for positional matches and scans
+        size_t text_bytes;
+    };
+
+    //What is measured of a backend, once built
+    struct backend {
+        std::function<size_t(std::string_view)> whole;
+        std::function<size_t(std::string_view, size_t)> match;
+        std::function<size_t(std::string_view)> scan;           //the number of keywords found
+        std::function<void(const std::string_view*, size_t, size_t*)> whole_batch;     //if there are batch lookups
+        size_t image_bytes;
+    };
+
+    size_t file_size(const char* filename){
+        FILE* f = std::fopen(filename, "rb");
+        std::fseek(f, 0, SEEK_END);
+        size_t size = std::ftell(f);
+        std::fclose(f);
+        return size;
+    }
+
+    //Finds the leftmost-longest keywords by matching at every position
+    size_t scan_by_match(const std::function<size_t(std::string_view, size_t)>& match, std::string_view line){
+        size_t found = 0;
+        for(size_t pos = 0; pos < line.length(); ){
+            size_t len = match(line, pos);
+            if(len != std::string::npos && len > 0){
+                ++found;
+                pos += len;
+            }
+            else
+                ++pos;
+        }
+        return found;
+    }
+
+    void header(const std::string& title){
+        std::cout << "\n" << title << "\n"
+                  << "  " << std::left << std::setw(26) << "backend" << std::right
+                  << std::setw(11) << "build ms" << std::setw(11) << "bytes/key"
+                  << std::setw(11) << "whole ns" << std::setw(10) << "p50 ns" << std::setw(10) << "p99 ns"
+                  << std::setw(11) << "batch ns" << std::setw(11) << "match ns" << std::setw(11) << "scan MB/s" << std::setw(10) << "found" << "\n";
+    }
+
+    template<typename Build>
+    void report(const std::string& name, const workload& work, Build build){
+        size_t before = live_bytes;
+        auto start = bench_clock::now();
+        backend b = build();
+        double build_ms = std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+        size_t bytes = b.image_bytes ? b.image_bytes : live_bytes - before;
+
+        //Throughput of whole-string lookups, then latencies on a sample of them
+        size_t found = 0;
+        start = bench_clock::now();
+        for(const std::string& query : work.queries)
+            found += b.whole(query) != std::string::npos;
+        double whole_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / work.queries.size();
+
+        //The same lookups in batches of 64, if the backend has them
+        double batch_ns = 0;
+        if(b.whole_batch){
+            std::vector<std::string_view> views(work.queries.begin(), work.queries.end());
+            std::vector<size_t> results(views.size());
+            start = bench_clock::now();
+            for(size_t i = 0; i < views.size(); i += 64)
+                b.whole_batch(&views[i], std::min<size_t>(64, views.size() - i), &results[i]);
+            batch_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / views.size();
+        }
+
+        std::vector<double> latency;
+        for(size_t i = 0; i < work.queries.size() && i < 100000; ++i){
+            auto op_start = bench_clock::now();
+            found += b.whole(work.queries[i]) != std::string::npos;
+            latency.push_back(std::chrono::duration<double, std::nano>(bench_clock::now() - op_start).count());
+        }
+        std::sort(latency.begin(), latency.end());
+        auto pct = [&](double p){ return latency[std::min(latency.size() - 1, size_t(p * latency.size()))]; };
+
+        //Positional matches at the start of every word
+        size_t matches = 0;
+        start = bench_clock::now();
+        for(const std::string& line : work.lines){
+            for(size_t pos = 0; pos < line.length(); pos = line.find(' ', pos) + 1){
+                matches += b.match(line, pos) != std::string::npos;
+                if(line.find(' ', pos) == std::string::npos)
+                    break;
+            }
+        }
+        double match_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / matches;
+
+        size_t scanned = 0;
+        start = bench_clock::now();
+        for(const std::string& line : work.lines)
+            scanned += b.scan(line);
+        double scan_s = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+        std::cout << "  " << std::left << std::setw(26) << name << std::right
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(11) << build_ms
+                  << std::setw(11) << double(bytes) / work.keys.size()
+                  << std::setw(11) << whole_ns
+                  << std::setw(10) << pct(0.50)
+                  << std::setw(10) << pct(0.99)
+                  << std::setw(11);
+        if(b.whole_batch)
+            std::cout << batch_ns;
+        else
+            std::cout << "-";
+        std::cout << std::setw(11) << match_ns
+                  << std::setw(11) << work.text_bytes / scan_s / 1e6
+                  << std::setw(10) << found + scanned << "\n";
+    }
+
+    std::string syllables(std::mt19937& rng, size_t n){
+        static const char* parts[] = {
+            "ka", "to", "ri", "mo", "sen", "dar", "el", "qu", "ist", "ver", "ant", "po",
+            "lin", "ex", "ra", "ne", "on", "tu", "ble", "sta", "ing", "co", "de", "ma"
+        };
+        std::string word;
+        for(size_t i = 0; i < n; ++i)
+            word += parts[rng() % (sizeof(parts) / sizeof(parts[0]))];
+        return word;
+    }
+
+    std::string identifier(std::mt19937& rng){
+        std::string id = syllables(rng, 1 + rng() % 3);
+        for(size_t i = 0, n = rng() % 3; i < n; ++i)
+            id += "_" + syllables(rng, 1 + rng() % 2);
+        if(rng() % 4 == 0)
+            id += std::to_string(rng() % 100);
+        return id;
+    }
+
+    std::string url(std::mt19937& rng){
+        static const char* tlds[] = {"com", "org", "net", "io", "de"};
+        std::string u = (rng() % 2 ? "https://" : "http://") + syllables(rng, 2 + rng() % 2) + "." + tlds[rng() % 5];
+        for(size_t i = 0, n = 1 + rng() % 3; i < n; ++i)
+            u += "/" + syllables(rng, 1 + rng() % 3);
+        return u;
+    }
+
+    std::string word(std::mt19937& rng){
+        return syllables(rng, 1 + rng() % 4);
+    }
+
+    //A key with one byte changed, which is most likely not a key
+    std::string near_miss(const std::string& key, std::mt19937& rng){
+        std::string miss = key;
+        if(!miss.empty())
+            miss[rng() % miss.length()] = 'z';
+        return miss;
+    }
+
+    workload make_workload(size_t count, const std::function<std::string(std::mt19937&)>& key){
+        std::mt19937 rng(12345);
+        workload work;
+
+        std::unordered_set<std::string> seen;
+        for(size_t attempts = 0; work.keys.size() < count && attempts < 4 * count + 100; ++attempts){
+            std::string k = key(rng);
+            if(seen.insert(k).second)
+                work.keys.push_back(k);
+        }
+
+        size_t num_queries = std::max<size_t>(100000, std::min<size_t>(count, 1000000));
+        for(size_t i = 0; i < num_queries; ++i){
+            const std::string& k = work.keys[rng() % work.keys.size()];
+            work.queries.push_back(i % 2 ? k : near_miss(k, rng));
+        }
+
+        work.text_bytes = 0;
+        for(size_t i = 0; i < 20000; ++i){
+            std::string line;
+            for(size_t j = 0, n = 4 + rng() % 8; j < n; ++j){
+                const std::string& k = work.keys[rng() % work.keys.size()];
+                line += (j ? " " : "") + (rng() % 2 ? k : near_miss(k, rng));
+            }
+            work.text_bytes += line.length() + 1;
+            work.lines.push_back(line);
+        }
+        return work;
+    }
+
+    void run(const std::string& shape, size_t count, const std::function<std::string(std::mt19937&)>& key){
+        workload work = make_workload(count, key);
+        header(shape + ", " + std::to_string(work.keys.size()) + " keys");
+
+        {
+            length_buckets set;
+            report("length buckets", work, [&]{
+                for(const std::string& k : work.keys)
+                    set.insert(k);
+                backend b;
+                b.whole = [&](std::string_view s){ return set.match_whole(s); };
+                b.match = [&](std::string_view s, size_t pos){ return set.match(s, pos); };
+                b.scan  = [&](std::string_view s){ return scan_by_match(b.match, s); };
+                b.image_bytes = 0;
+                return b;
+            });
+        }
+        for(bool filter : {false, true}){
+            util::keyword_set set;
+            report(filter ? "keyword_set + filter" : "keyword_set", work, [&]{
+                if(filter)
+                    set.enable_filter(0.01);
+                for(const std::string& k : work.keys)
+                    set.insert(k);
+                backend b;
+                b.whole = [&](std::string_view s){ return set.match_whole(s); };
+                b.match = [&](std::string_view s, size_t pos){ return set.match(s, pos, false); };
+                b.scan  = [&](std::string_view s){
+                    size_t found = 0;
+                    set.scan_all(s, [&](size_t, size_t){ ++found; }, false);
+                    return found;
+                };
+                b.whole_batch = [&](const std::string_view* strs, size_t count, size_t* results){
+                    set.match_whole_batch(strs, count, results);
+                };
+                b.image_bytes = 0;
+                return b;
+            });
+        }
+        {
+            util::frozen_keyword_set<> set;
+            report("frozen_keyword_set", work, [&]{
+                set = util::frozen_keyword_set<>(work.keys, work.keys.size(), true);
+                backend b;
+                b.whole = [&](std::string_view s){ return set.match_whole(s); };
+                b.match = [&](std::string_view s, size_t pos){ return set.match(s, pos, false); };
+                b.scan  = [&](std::string_view s){ return scan_by_match(b.match, s); };
+                b.image_bytes = 0;
+                return b;
+            });
+            set.save(image_file);
+        }
+        {
+            std::unique_ptr<util::mapped_keyword_set> set;
+            report("mapped_keyword_set", work, [&]{
+                set.reset(new util::mapped_keyword_set(image_file, false));
+                backend b;
+                b.whole = [&](std::string_view s){ return set->match_whole(s); };
+                b.match = [&](std::string_view s, size_t pos){ return set->match(s, pos, false); };
+                b.scan  = [&](std::string_view s){ return scan_by_match(b.match, s); };
+                b.image_bytes = file_size(image_file);
+                return b;
+            });
+        }
+        {
+            util::keyword_map<uint32_t> map;
+            report("keyword_map<uint32_t>", work, [&]{
+                for(size_t i = 0; i < work.keys.size(); ++i)
+                    map.insert({work.keys[i], uint32_t(i)});
+                backend b;
+                b.whole = [&](std::string_view s){ return map.match_whole(s).second; };
+                b.match = [&](std::string_view s, size_t pos){ return map.match(s, pos, false).second; };
+                b.scan  = [&](std::string_view s){
+                    size_t found = 0;
+                    map.scan_all(s, [&](size_t, size_t, uint32_t){ ++found; }, false);
+                    return found;
+                };
+                b.whole_batch = [&](const std::string_view* strs, size_t count, size_t* results){
+                    std::pair<uint32_t, size_t> matches[64];
+                    map.match_whole_batch(strs, count, matches);
+                    for(size_t i = 0; i < count; ++i)
+                        results[i] = matches[i].second;
+                };
+                b.image_bytes = 0;
+                return b;
+            });
+        }
+        {
+            std::vector<uint32_t> values(work.keys.size());
+            for(size_t i = 0; i < values.size(); ++i)
+                values[i] = i;
+
+            util::frozen_keyword_map<uint32_t> map;
+            report("frozen_keyword_map", work, [&]{
+                map = util::frozen_keyword_map<uint32_t>(work.keys, values, work.keys.size(), true);
+                backend b;
+                b.whole = [&](std::string_view s){ return map.match_whole(s).second; };
+                b.match = [&](std::string_view s, size_t pos){ return map.match(s, pos, false).second; };
+                b.scan  = [&](std::string_view s){ return scan_by_match(b.match, s); };
+                b.image_bytes = 0;
+                return b;
+            });
+            map.save(image_file);
+        }
+        {
+            std::unique_ptr< util::mapped_keyword_map<uint32_t> > map;
+            report("mapped_keyword_map", work, [&]{
+                map.reset(new util::mapped_keyword_map<uint32_t>(image_file, false));
+                backend b;
+                b.whole = [&](std::string_view s){ return map->match_whole(s).second; };
+                b.match = [&](std::string_view s, size_t pos){ return map->match(s, pos, false).second; };
+                b.scan  = [&](std::string_view s){ return scan_by_match(b.match, s); };
+                b.image_bytes = file_size(image_file);
+                return b;
+            });
+        }
+        std::remove(image_file);
+    }
+}
+
+int main(int argc, char** argv){
+    size_t max_keys = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+    for(size_t count : {10, 1000, 100000, 1000000, 10000000}){
+        if(count > max_keys)
+            break;
+        run("identifiers", count, identifier);
+        run("URLs", count, url);
+        run("words", count, word);
+    }
+
+    return 0;
+}
@@ -0,0 +1,376 @@
+//Benchmarks util::regex against std::regex and the hand-written matching loops
+//used by the DOM parser, on generated corpora.
+//
+//Build and run from this directory with
+//    g++ -std=c++17 -O2 -pthread -I.. regex_bench.cpp ../src/regex.cpp ../src/regex_dfa.cpp ../src/file_parser.cpp ../src/char_utils.cpp -o regex_bench
+//    ./regex_bench [scale]
+//
+//For every case and engine, it reports the throughput, the latency percentiles
+//of a single operation (finding all matches in one line, or matching one token),
+//and the number of heap allocations per operation.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../regex.hpp"
+#include "../regex_dfa.hpp"
+#include "../file_parser.hpp"
+
+//Count every allocation made by the process
+static std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size){
+    ++allocations;
+    if(void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+using fp = util::file_parser;
+using bench_clock = std::chrono::steady_clock;
+
+namespace {
+
+    struct corpus {
+        std::string name;
+        std::vector<std::string> lines;
+        size_t bytes;
+    };
+
+    //An engine runs one operation on one line, and returns the number of matches
+    using engine = std::function<size_t(size_t line)>;
+
+    void report(const std::string& name, const corpus& text, const std::function<void()>& setup,
+                const engine& run){
+        setup();
+
+        std::vector<double> latency;
+        latency.reserve(text.lines.size());
+
+        size_t matches = 0;
+        size_t before = allocations;
+        auto start = bench_clock::now();
+
+        for(size_t line = 0; line < text.lines.size(); ++line){
+            auto op_start = bench_clock::now();
+            matches += run(line);
+            latency.push_back(std::chrono::duration<double, std::nano>(bench_clock::now() - op_start).count());
+        }
+
+        double total = std::chrono::duration<double>(bench_clock::now() - start).count();
+        size_t allocs = allocations - before;
+
+        std::sort(latency.begin(), latency.end());
+        auto pct = [&](double p){ return latency[std::min(latency.size() - 1, size_t(p * latency.size()))]; };
+
+        std::cout << "  " << std::left << std::setw(28) << name << std::right
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(10) << (text.bytes / total / 1e6) << " MB/s"
+                  << std::setw(12) << pct(0.50)
+                  << std::setw(12) << pct(0.90)
+                  << std::setw(12) << pct(0.99)
+                  << std::setw(13) << latency.back()
+                  << std::setw(10) << std::setprecision(2) << double(allocs) / text.lines.size()
+                  << std::setw(10) << matches << "\n";
+    }
+
+    void header(const std::string& title){
+        std::cout << "\n" << title << "\n"
+                  << "  " << std::left << std::setw(28) << "engine" << std::right
+                  << std::setw(15) << "throughput"
+                  << std::setw(12) << "p50 ns" << std::setw(12) << "p90 ns" << std::setw(12) << "p99 ns"
+                  << std::setw(13) << "max ns" << std::setw(10) << "allocs/op" << std::setw(10) << "matches" << "\n";
+    }
+
+    corpus make_corpus(const std::string& name, size_t count, const std::function<std::string(std::mt19937&)>& line){
+        std::mt19937 rng(12345);
+        corpus text{name, {}, 0};
+        for(size_t i = 0; i < count; ++i){
+            text.lines.push_back(line(rng));
+            text.bytes += text.lines.back().length() + 1;
+        }
+        return text;
+    }
+
+    std::string word(std::mt19937& rng){
+        static const char* words[] = {
+            "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit",
+            "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore", "et", "dolore"
+        };
+        return words[rng() % (sizeof(words) / sizeof(words[0]))];
+    }
+
+    //All non-overlapping matches in a line, for each engine
+    size_t count_util(const util::regex& re, const std::string& str, util::regex_stack& stack){
+        size_t count = 0, pos = 0, begin, len;
+        while(pos <= str.length() && re.search(str, pos, begin, len, stack)){
+            ++count;
+            pos = begin + std::max<size_t>(len, 1);
+        }
+        return count;
+    }
+    size_t count_std(const std::regex& re, const std::string& str){
+        return std::distance(std::sregex_iterator(str.begin(), str.end(), re), std::sregex_iterator());
+    }
+    size_t count_dfa(util::regex_dfa& dfa, const std::string& str){
+        //Only decides whether the line has a match at all
+        uint32_t s = dfa.start();
+        int32_t match;
+        for(unsigned char ch : str){
+            s = dfa.next(s, ch, match);
+            if(match >= 0)
+                return 1;
+        }
+        dfa.next(s, util::regex_dfa::end_symbol, match);
+        return match >= 0;
+    }
+
+    void search_case(const std::string& title, const corpus& text, const std::string& pattern,
+                     bool with_std = true){
+        header(title + "  /" + pattern + "/");
+
+        util::regex re(pattern), plain(pattern, util::regex::no_possessify);
+        util::regex_stack stack(1 << 20);
+        size_t exceeded = 0;
+
+        report("util::regex", text, [&]{ exceeded = 0; }, [&](size_t line){
+            size_t count = count_util(re, text.lines[line], stack);
+            exceeded += stack.budget_exceeded();
+            return count;
+        });
+        if(exceeded)
+            std::cout << "    (step budget exceeded on " << exceeded << " lines)\n";
+
+        report("util::regex no_possessify", text, [&]{ exceeded = 0; }, [&](size_t line){
+            size_t count = count_util(plain, text.lines[line], stack);
+            exceeded += stack.budget_exceeded();
+            return count;
+        });
+        if(exceeded)
+            std::cout << "    (step budget exceeded on " << exceeded << " lines)\n";
+
+        if(util::regex_dfa::supports(re)){
+            util::regex_dfa dfa(re);
+            report("util::regex_dfa (lines)", text, []{}, [&](size_t line){
+                return count_dfa(dfa, text.lines[line]);
+            });
+        }
+
+        if(with_std){
+            std::regex std_re(pattern);
+            report("std::regex", text, []{}, [&](size_t line){
+                return count_std(std_re, text.lines[line]);
+            });
+        }
+    }
+
+    void capture_case(const corpus& text, const std::string& pattern){
+        header("capture extraction  /" + pattern + "/");
+
+        util::regex re(pattern);
+        util::regex_match<> result;
+        size_t sum = 0;
+
+        report("util::regex + regex_match", text, []{}, [&](size_t line){
+            const std::string& str = text.lines[line];
+            size_t count = 0;
+            for(size_t pos = 0; pos <= str.length() && re.search(str, pos, result); ++count){
+                sum += result[1].length() + result[2].length();
+                pos = result.position() + std::max<size_t>(result.length(), 1);
+            }
+            return count;
+        });
+
+        std::regex std_re(pattern);
+        report("std::regex + smatch", text, []{}, [&](size_t line){
+            const std::string& str = text.lines[line];
+            size_t count = 0;
+            for(auto it = std::sregex_iterator(str.begin(), str.end(), std_re); it != std::sregex_iterator(); ++it, ++count)
+                sum += (*it)[1].length() + (*it)[2].length();
+            return count;
+        });
+
+        if(sum == 0)
+            std::cout << "    (nothing captured)\n";
+    }
+
+    //The loop from DOM::dom_element::parse_json_value, minus the error handling
+    bool hand_json_string(fp& parser){
+        if(!parser.match('"', fp::consume))
+            return false;
+
+        for(;;){
+            if(!parser.seek_any_of("\"\\" + fp::code_chars, fp::single_line) || !parser)
+                return false;
+            if(*parser == '"')
+                break;
+            if(parser.match_any_of(fp::code_chars))
+                return false;
+
+            if(!++parser)
+                return false;
+            if(parser.match_any_of("\"\\/bfnrt"))
+                ++parser;
+            else if(*parser == 'u'){
+                for(size_t i = 0; i < 4; ++i){
+                    ++parser;
+                    if(!std::isxdigit(*parser))
+                        return false;
+                }
+                ++parser;
+            }
+            else
+                return false;
+        }
+        ++parser;
+        return !parser;
+    }
+
+    //Likewise, for -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][-+]?[0-9]+)?
+    bool hand_json_number(fp& parser){
+        parser.match('-', fp::consume);
+        if(parser.match('0', fp::consume)){
+            if(parser && std::isdigit(*parser))
+                return false;
+        }
+        else if(parser.match_any_of("123456789", fp::consume))
+            parser.seek_not_of("0123456789", fp::single_line);
+        else
+            return false;
+
+        if(parser.match('.', fp::consume)){
+            if(!parser.match_any_of("0123456789", fp::consume))
+                return false;
+            parser.seek_not_of("0123456789", fp::single_line);
+        }
+        if(parser.match_any_of("eE", fp::consume)){
+            parser.match_any_of("+-", fp::consume);
+            if(!parser.match_any_of("0123456789", fp::consume))
+                return false;
+            parser.seek_not_of("0123456789", fp::single_line);
+        }
+        return !parser;
+    }
+
+    void token_case(const std::string& title, const corpus& text, const std::string& pattern,
+                    bool (*hand)(fp&)){
+        header(title + "  /" + pattern + "/");
+
+        util::regex re(pattern);
+        std::regex std_re(pattern);
+
+        std::string joined;
+        for(const auto& line : text.lines)
+            joined += line + "\n";
+        std::istringstream in;
+        std::unique_ptr<fp> parser;
+        auto reset = [&]{
+            in.clear();
+            in.str(joined);
+            parser = std::make_unique<fp>(in);
+        };
+
+        report("util::regex (string)", text, []{}, [&](size_t line){
+            size_t len;
+            const std::string& str = text.lines[line];
+            return re.match(str, 0, len) && len == str.length();
+        });
+        report("util::regex (file_parser)", text, reset, [&](size_t){
+            size_t len;
+            bool ok = re.match(*parser, len, fp::consume) && !*parser;
+            parser->advance_line();
+            return ok;
+        });
+        report("hand-written (file_parser)", text, reset, [&](size_t){
+            bool ok = hand(*parser);
+            parser->advance_line();
+            return ok;
+        });
+        report("std::regex", text, []{}, [&](size_t line){
+            return std::regex_match(text.lines[line], std_re);
+        });
+    }
+}
+
+int main(int argc, char** argv){
+    size_t scale = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1;
+    size_t lines = 20000 * scale;
+
+    corpus prose = make_corpus("prose", lines, [](std::mt19937& rng){
+        std::string line;
+        for(size_t i = 0, n = 4 + rng() % 12; i < n; ++i)
+            line += (i ? " " : "") + word(rng);
+        if(rng() % 50 == 0)
+            line += " needle";
+        return line;
+    });
+
+    corpus logs = make_corpus("logs", lines, [](std::mt19937& rng){
+        std::ostringstream line;
+        line << "2024-01-" << 10 + rng() % 20 << " " << rng() % 24 << ":" << rng() % 60
+             << " [worker_" << rng() % 16 << "] took " << rng() % 1000 << "." << rng() % 1000
+             << " ms user_id=" << rng() % 100000 << " status=" << 200 + rng() % 300
+             << " path=/api/v" << rng() % 3 << "/" << word(rng);
+        return line.str();
+    });
+
+    corpus almost = make_corpus("pathological", lines / 100, [](std::mt19937& rng){
+        return std::string(16 + rng() % 8, 'a');
+    });
+
+    corpus strings = make_corpus("json strings", lines, [](std::mt19937& rng){
+        std::string line = "\"";
+        for(size_t i = 0, n = 4 + rng() % 40; i < n; ++i){
+            switch(rng() % 20){
+                case 0:     line += "\\n";      break;
+                case 1:     line += "\\u00e9";  break;
+                case 2:     line += "\\\"";     break;
+                default:    line += char('a' + rng() % 26);
+            }
+        }
+        return line + "\"";
+    });
+
+    corpus numbers = make_corpus("json numbers", lines, [](std::mt19937& rng){
+        std::ostringstream line;
+        if(rng() % 3 == 0)
+            line << '-';
+        line << rng() % 100000;
+        if(rng() % 2)
+            line << '.' << rng() % 1000;
+        if(rng() % 5 == 0)
+            line << 'e' << (rng() % 2 ? "-" : "") << rng() % 30;
+        return line.str();
+    });
+
+    std::cout << "Corpora of " << lines << " lines (pathological: " << almost.lines.size() << ")\n";
+
+    search_case("literal-heavy", prose, "needle");
+    search_case("literal alternatives", prose, "tempor|labore|eiusmod");
+    search_case("character classes", logs, "[0-9]+\\.[0-9]+ ms");
+    search_case("identifiers", logs, "\\b[A-Za-z_][A-Za-z0-9_]*=[0-9]+");
+    search_case("pathological backtracking", almost, "(a+)+b", false);
+    search_case("pathological alternation", almost, "(a|aa)*c", false);
+    capture_case(logs, "(\\w+)=(\\d+)");
+    token_case("JSON strings", strings, "\"([^\"\\\\\\x00-\\x1f]|\\\\[\"\\\\/bfnrt]|\\\\u[0-9a-fA-F]{4})*\"", hand_json_string);
+    token_case("JSON numbers", numbers, "-?(0|[1-9][0-9]*)(\\.[0-9]+)?([eE][-+]?[0-9]+)?", hand_json_number);
+
+    return 0;
+}
@@ -3,9 +3,34 @@
 
 #include <cctype>
 #include <string>
+#include <string_view>
 
 namespace util {
 
+    namespace detail {
+        //ASCII case mappings, independent of the locale
+        struct case_tables {
+            unsigned char lower[256];
+            unsigned char upper[256];
+
+            constexpr case_tables() : lower(), upper() {
+                for(unsigned c = 0; c < 256; ++c){
+                    lower[c] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+                    upper[c] = (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+                }
+            }
+        };
+        inline constexpr case_tables case_table{};
+    }
+
+    /** Converts an ASCII character to lowercase by a table lookup. */
+    constexpr char lower_char(char ch){ return detail::case_table.lower[(unsigned char) ch]; }
+    /** Converts an ASCII character to uppercase by a table lookup. */
+    constexpr char upper_char(char ch){ return detail::case_table.upper[(unsigned char) ch]; }
+
+    /** Checks if two strings are equal when ignoring (ASCII) case, without copying them. */
+    bool equal_icase(std::string_view a, std::string_view b);
+
     /** Makes an all-lowercase copy of a string. */
     std::string lowercase(const std::string& str);
     /** Makes an all-uppercase copy of a string. */
@@ -28,7 +53,7 @@ namespace util {
      * Characters outside the bounds of the string count as non-word characters,
      * and do not cause any errors.
      */
-    bool word_char(const std::string& str, size_t pos);
+    bool word_char(std::string_view str, size_t pos);
 
 };
 
@@ -0,0 +1,187 @@
+#ifndef UTIL_CONCURRENT_KEYWORD_MAP_H
+#define UTIL_CONCURRENT_KEYWORD_MAP_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "keyword_map.hpp"
+
+namespace util {
+
+    /**
+     * @brief A @c keyword_map shared between threads, which read it without
+     * ever taking a lock, while it is occasionally replaced.
+     *
+     * The map is never changed in place. An update copies (or replaces) the
+     * current version, changes the copy, and publishes it with a single atomic
+     * store; readers see either the old or the new version as a whole. An old
+     * version is freed as soon as no reader can still be using it, which the
+     * updating thread waits for.
+     *
+     * To know this, each reader announces itself in one of a fixed number of
+     * counters, chosen by its thread and each on its own cache line, so readers
+     * on different cores do not contend. Readers only increment and decrement
+     * their counter and load the current version. The counters come in two
+     * generations: an update switches new readers to the other one, and waits
+     * for the counters of the old generation to drop to zero. A reader that
+     * finds the generation switched after counting itself in counts itself
+     * in again, in the new one.
+     *
+     * Reading through a @c snapshot pins a version for as long as the snapshot
+     * lives, and so holds up updates; the lookups below only pin it during the
+     * lookup, and return copies of the values.
+     *
+     * @tparam T the type of the values. Must be copy-constructible.
+     */
+    template<typename T>
+    class concurrent_keyword_map {
+    private:
+        using map_type = keyword_map<T>;
+
+        static constexpr size_t num_slots = 64;
+
+        struct alignas(64) slot {
+            std::atomic<size_t> readers[2];
+        };
+
+        std::atomic<const map_type*> current;
+        std::atomic<unsigned> phase;
+        std::unique_ptr<slot[]> slots;
+        std::mutex update_mutex;
+
+        slot& own_slot() const {
+            static thread_local size_t index = std::hash<std::thread::id>()(std::this_thread::get_id()) % num_slots;
+            return slots[index];
+        }
+
+        //Makes a map the current version, and frees the previous one once no
+        //reader uses it any more. Requires the update mutex.
+        void publish(const map_type* next){
+            const map_type* prev = current.exchange(next);
+
+            unsigned old = phase.load();
+            phase.store(old ^ 1);
+            for(size_t s = 0; s < num_slots; ++s)
+                while(slots[s].readers[old].load() != 0)
+                    std::this_thread::yield();
+
+            delete prev;
+        }
+
+    public:
+        /**
+         * @brief A version of the map, which stays valid (and unchanged) while
+         * the snapshot exists.
+         */
+        class snapshot {
+        private:
+            friend class concurrent_keyword_map;
+
+            std::atomic<size_t>* counter;
+            const map_type* map;
+
+            //The phase is checked again after announcing the reader: if an update
+            //switched it in between, that update may not have waited for the
+            //counter, and a later one would not either, so announce again
+            snapshot(const concurrent_keyword_map& owner) : counter(nullptr), map(nullptr) {
+                slot& own = owner.own_slot();
+                for(;;){
+                    unsigned announced = owner.phase.load();
+                    counter = &own.readers[announced];
+                    counter->fetch_add(1);
+                    if(owner.phase.load() == announced)
+                        break;
+                    counter->fetch_sub(1);
+                }
+                map = owner.current.load();
+            }
+
+        public:
+            snapshot(const snapshot&) = delete;
+            snapshot& operator= (const snapshot&) = delete;
+
+            ~snapshot(){
+                counter->fetch_sub(1);
+            }
+
+            const map_type& operator* () const { return *map; }
+            const map_type* operator-> () const { return map; }
+        };
+
+        /** @brief Creates an empty map. */
+        concurrent_keyword_map() : concurrent_keyword_map(map_type()) {}
+
+        /** @brief Creates a map whose first version is @p init. */
+        explicit concurrent_keyword_map(map_type init)
+         : current(new map_type(std::move(init))), phase(0), slots(new slot[num_slots]), update_mutex()
+        {
+            for(size_t s = 0; s < num_slots; ++s){
+                slots[s].readers[0].store(0);
+                slots[s].readers[1].store(0);
+            }
+        }
+
+        concurrent_keyword_map(const concurrent_keyword_map&) = delete;
+        concurrent_keyword_map& operator= (const concurrent_keyword_map&) = delete;
+
+        /** @brief Must not be called while any thread still reads the map. */
+        ~concurrent_keyword_map(){
+            delete current.load();
+        }
+
+        /** @brief Pins the current version, for several lookups or a scan. */
+        snapshot read() const { return snapshot(*this); }
+
+        /**
+         * @brief Like @c keyword_map::match, but copies the matching value.
+         * @return the length of the match, or @c std::string::npos if no keyword matched.
+         */
+        size_t match(std::string_view str, size_t pos, T& value, bool whole_word = true) const {
+            snapshot version(*this);
+            auto match = version->match(str, pos, whole_word);
+            if(match.first != map_type::none)
+                value = version->value(match.first);
+            return match.second;
+        }
+
+        /** @brief Like @c match, but matches against the full string. */
+        size_t match_whole(std::string_view str, T& value) const {
+            snapshot version(*this);
+            auto match = version->match_whole(str);
+            if(match.first != map_type::none)
+                value = version->value(match.first);
+            return match.second;
+        }
+
+        /**
+         * @brief Publishes a new version of the map, such as a reloaded one,
+         * and waits until the previous version can be freed.
+         */
+        void replace(map_type next){
+            std::lock_guard<std::mutex> lock(update_mutex);
+            publish(new map_type(std::move(next)));
+        }
+
+        /**
+         * @brief Publishes a changed copy of the current version. Concurrent
+         * updates are applied one after the other.
+         *
+         * @param change called with the copy to change.
+         */
+        template<typename F>
+        void update(F change){
+            std::lock_guard<std::mutex> lock(update_mutex);
+            std::unique_ptr<map_type> next(new map_type(*current.load()));
+            change(*next);
+            publish(next.release());
+        }
+    };
+
+};
+
+#endif
@@ -379,11 +379,9 @@ namespace detail{
             if(std::isdigit(str[0]))
                 return (bool) int_val();
                 
-            std::string ins = util::lowercase(str);
-                
-            if(ins == "true")
+            if(util::equal_icase(str, "true"))
                 return true;
-            else if(ins == "false")
+            else if(util::equal_icase(str, "false"))
                 return false;
             else
                 target->error(what() + " has value \"" + str + "\", true/false (or number) expected");
@@ -9,10 +9,13 @@
 #include <sstream>
 #include <fstream>
 #include <deque>
+#include <memory_resource>
 #include <stack>
 #include <string>
+#include <string_view>
 
 #include "keyword_map.hpp"
+#include "keyword_set.hpp"
 
 #if UTIL_FILE_PARSER_ERROR_THROW
 #include <exception>
@@ -27,7 +30,7 @@ namespace util {
     
     class file_parser {
     private:  
-        file_parser();
+        explicit file_parser(std::pmr::memory_resource* resource);
         
         std::string filename;
         
@@ -38,7 +41,8 @@ namespace util {
         
         char cont_char;
         
-        std::deque< std::pair<std::string, size_t> > bufs;
+        //The lines kept for marks, and the marks, come from the memory resource
+        std::pmr::deque< std::pair<std::pmr::string, size_t> > bufs;
         size_t max_line;
         size_t min_line;
         
@@ -52,7 +56,7 @@ namespace util {
             size_t line;
             size_t col;
         };
-        std::stack< mark_location > marks;
+        std::stack< mark_location, std::pmr::deque<mark_location> > marks;
                 
         bool advance_char(size_t opts = 0);
         bool get_line(const std::string& err = "");
@@ -65,14 +69,15 @@ namespace util {
         bool match_impl(const std::string& str, size_t opts, const std::string& err, match_style style);
                                 
         void error(bool show_context, const std::string& message) const;
-        void error(bool show_context, const std::string& message, const std::string& buf, size_t pos, bool compute_offset = false) const;
-        static void show_error_context(std::ostream& err, const std::string& buf, size_t pos);
+        void error(bool show_context, const std::string& message, std::string_view buf, size_t pos, bool compute_offset = false) const;
+        static void show_error_context(std::ostream& err, std::string_view buf, size_t pos);
         
         void skip_byte_order_mark();
         
     public:
-        file_parser(std::istream& ist);
-        file_parser(const std::string& filename, const std::string& err = "");
+        file_parser(std::istream& ist, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+        file_parser(const std::string& filename, const std::string& err = "",
+                    std::pmr::memory_resource* resource = std::pmr::get_default_resource());
         
         void enable_echoing(bool print_current = true, const std::string& prefix = "");
         void enable_echoing(std::ostream& ost, bool print_current = true, const std::string& prefix = "");
@@ -115,7 +120,35 @@ namespace util {
         bool match_not_of(const std::string& str, size_t opts = 0, const std::string& err = "");
         bool match_word_boundary(size_t opts = 0, const std::string& err = "");
         
-        const std::string& get_buffer() const;
+        /**
+         * @brief Matches the longest keyword at the current position, walking the
+         * keywords' trie directly over the current line.
+         * 
+         * The options are those of @c match, except that @c backwards is an
+         * error; with @c consume, the parser moves past the keyword in one step.
+         * 
+         * @return the id of the matching keyword and the length of the match, as
+         *      for @c keyword_map::match.
+         */
+        template<typename T>
+        std::pair<uint32_t, size_t>
+        match_keyword(const keyword_map<T>& keywords, size_t opts = 0, bool whole_word = true, const std::string& err = "");
+        size_t match_keyword(const keyword_set& keywords, size_t opts = 0, bool whole_word = true, const std::string& err = "");
+        
+        /**
+         * @brief Moves to the next keyword, like @c seek, finding it with the
+         * keywords' automaton line by line (so keywords can not span lines).
+         * The options are those of @c seek, except that @c backwards is an error.
+         * 
+         * @return the id of the matching keyword and the length of the match, as
+         *      for @c keyword_map::match.
+         */
+        template<typename T>
+        std::pair<uint32_t, size_t>
+        seek_keyword(const keyword_map<T>& keywords, size_t opts = 0, bool whole_word = true, const std::string& err = "");
+        size_t seek_keyword(const keyword_set& keywords, size_t opts = 0, bool whole_word = true, const std::string& err = "");
+        
+        std::string_view get_buffer() const;
         size_t get_column() const;
         size_t get_line_number() const;
         
@@ -156,6 +189,104 @@ namespace util {
         static void error(const source& src, const std::string& message);
     };
     
+    template<typename T>
+    std::pair<uint32_t, size_t>
+    file_parser::match_keyword(const keyword_map<T>& keywords, size_t opts, bool whole_word, const std::string& err){
+        if(opts & backwards)
+            error("Keywords can not be matched backwards");
+        
+        auto match = keywords.match(get_buffer(), col, whole_word);
+        
+        if(match.second == std::string::npos){
+            if(!err.empty())
+                error(err);
+        }
+        else if(opts & consume)
+            col += match.second;
+        
+        return match;
+    }
+    
+    template<typename T>
+    std::pair<uint32_t, size_t>
+    file_parser::seek_keyword(const keyword_map<T>& keywords, size_t opts, bool whole_word, const std::string& err){
+        if(opts & backwards)
+            error("Keywords can not be matched backwards");
+        
+        if(opts & lookahead)
+            set_mark();
+        
+        size_t begin, len;
+        uint32_t match;
+        for(;;){
+            match = keywords.find(get_buffer(), col, begin, len, whole_word);
+            if(match != keywords.none){
+                col = (opts & consume) ? begin + len : begin;
+                break;
+            }
+            
+            col = get_buffer().length();
+            if((opts & single_line) || !advance_line())
+                break;
+        }
+        
+        if(opts & lookahead)
+            revert_to_mark(remove_mark);
+        
+        if(match != keywords.none)
+            return std::make_pair(match, len);
+        
+        if(!err.empty())
+            error(err);
+        return std::make_pair(match, std::string::npos);
+    }
+    
+    //Defined here rather than with the rest of the parser, so that only the
+    //programs using keyword sets need the keyword sources
+    inline size_t file_parser::match_keyword(const keyword_set& keywords, size_t opts, bool whole_word, const std::string& err){
+        if(opts & backwards)
+            error("Keywords can not be matched backwards");
+        
+        size_t len = keywords.match(get_buffer(), col, whole_word);
+        
+        if(len == std::string::npos){
+            if(!err.empty())
+                error(err);
+        }
+        else if(opts & consume)
+            col += len;
+        
+        return len;
+    }
+    
+    inline size_t file_parser::seek_keyword(const keyword_set& keywords, size_t opts, bool whole_word, const std::string& err){
+        if(opts & backwards)
+            error("Keywords can not be matched backwards");
+        
+        if(opts & lookahead)
+            set_mark();
+        
+        size_t begin, len = std::string::npos;
+        for(;;){
+            if(keywords.find(get_buffer(), col, begin, len, whole_word)){
+                col = (opts & consume) ? begin + len : begin;
+                break;
+            }
+            
+            len = std::string::npos;
+            col = get_buffer().length();
+            if((opts & single_line) || !advance_line())
+                break;
+        }
+        
+        if(opts & lookahead)
+            revert_to_mark(remove_mark);
+        
+        if(len == std::string::npos && !err.empty())
+            error(err);
+        return len;
+    }
+    
 };
 
 #endif
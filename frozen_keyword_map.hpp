@@ -0,0 +1,539 @@
+#ifndef UTIL_FROZEN_KEYWORD_MAP_H
+#define UTIL_FROZEN_KEYWORD_MAP_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "char_utils.hpp"
+
+namespace util {
+
+    namespace detail {
+
+        //Fixed-size storage when the number of keywords is known at compile
+        //time (N > 0), so tables can be built by constexpr functions
+        template<typename X, size_t N>
+        using frozen_array = std::conditional_t<N == 0, std::vector<X>, std::array<X, N>>;
+
+        template<typename X, size_t N>
+        constexpr frozen_array<X, N> frozen_alloc(size_t n){
+            if constexpr (N == 0)
+                return std::vector<X>(n, X());
+            else
+                return std::array<X, N>{};
+        }
+
+        //FNV-1a, with a final mix so that all bits depend on all bytes
+        constexpr uint64_t frozen_mix(uint64_t h, uint64_t seed){
+            h ^= seed * 0x9e3779b97f4a7c15;
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccd;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53;
+            h ^= h >> 33;
+            return h;
+        }
+        constexpr uint64_t frozen_hash(std::string_view key){
+            uint64_t h = 0xcbf29ce484222325;
+            for(char ch : key){
+                h ^= (unsigned char) ch;
+                h *= 0x100000001b3;
+            }
+            return frozen_mix(h, 0);
+        }
+
+        //The only slot where a key with hash h can be, in a table of n slots
+        template<typename Seeds>
+        constexpr size_t frozen_slot(const Seeds& seeds, size_t n, uint64_t h){
+            int32_t seed = seeds[h % n];
+            return seed < 0 ? size_t(-(seed + 1)) : size_t(frozen_mix(h, seed) % n);
+        }
+
+        //Finds the longest key at a position by trying each distinct length,
+        //longest first, with find(key) giving a key's slot or SIZE_MAX.
+        //Returns the slot and length, or SIZE_MAX and npos.
+        template<typename Lengths, typename Find>
+        std::pair<size_t, size_t> frozen_match(std::string_view str, size_t pos, bool whole_word,
+                                               const Lengths& lengths, size_t num_lengths, Find find){
+            if(pos > str.length() || (whole_word && util::word_char(str, pos-1)))
+                return {SIZE_MAX, std::string::npos};
+
+            std::string_view rest = str.substr(pos);
+            for(size_t k = 0; k < num_lengths; ++k){
+                size_t len = lengths[k];
+                if(len > rest.length() || (whole_word && util::word_char(str, pos + len)))
+                    continue;
+
+                size_t slot = find(rest.substr(0, len));
+                if(slot != SIZE_MAX)
+                    return {slot, len};
+            }
+            return {SIZE_MAX, std::string::npos};
+        }
+
+        //The distinct keys of a list built at run time, as the index of the
+        //first and of the last time each is listed, in the order of the first
+        //ones. Sorting the indices keeps this O(n log n) for large lists.
+        template<typename Keys>
+        std::vector< std::pair<size_t, size_t> > frozen_distinct(const Keys& keys, size_t count){
+            std::vector< size_t > order(count);
+            for(size_t i = 0; i < count; ++i)
+                order[i] = i;
+            std::stable_sort(order.begin(), order.end(), [&keys](size_t a, size_t b){
+                return std::string_view(keys[a]) < std::string_view(keys[b]);
+            });
+
+            std::vector< size_t > last(count, SIZE_MAX);
+            for(size_t k = 0; k < count; ){
+                size_t end = k + 1;
+                while(end < count && std::string_view(keys[order[end]]) == std::string_view(keys[order[k]]))
+                    ++end;
+                last[order[k]] = order[end-1];
+                k = end;
+            }
+
+            std::vector< std::pair<size_t, size_t> > distinct;
+            for(size_t i = 0; i < count; ++i)
+                if(last[i] != SIZE_MAX)
+                    distinct.emplace_back(i, last[i]);
+            return distinct;
+        }
+
+        enum frozen_value_kind : uint32_t {
+            frozen_no_values,       //a set
+            frozen_fixed_values,    //value_size bytes each
+            frozen_string_values    //strings, delimited by offsets into their chars
+        };
+
+        //The tables of a frozen set or map, as written into an image file;
+        //see keyword_image.hpp
+        struct frozen_image_parts {
+            size_t count;
+            const int32_t* seeds;
+            const size_t* lengths;
+            size_t num_lengths;
+            const uint32_t* key_offsets;        //count + 1 of them, or nullptr if count is 0
+            std::string_view key_chars;
+            frozen_value_kind value_kind;
+            size_t value_size;
+            size_t value_align;
+            std::string_view values;            //the bytes of the values, or the chars of the strings
+            const uint32_t* value_offsets;      //for strings, count + 1 of them
+        };
+
+        void write_frozen_image(const std::string& filename, const frozen_image_parts& parts);
+
+        //The keys, in the order of their slots: views of constant strings
+        //(such as literals) for fixed sizes, or copied into one string otherwise
+        template<size_t N>
+        struct frozen_keys {
+            std::array< std::string_view, N > views;
+
+            constexpr frozen_keys() : views() {}
+            constexpr void init(size_t){}
+            constexpr void set(size_t slot, std::string_view key){ views[slot] = key; }
+            constexpr void finish(size_t){}
+            constexpr std::string_view get(size_t slot) const { return views[slot]; }
+        };
+        template<>
+        struct frozen_keys<0> {
+            std::string chars;
+            std::vector< uint32_t > offsets;
+            std::vector< std::string_view > pending;
+
+            frozen_keys() : chars(), offsets(), pending() {}
+            void init(size_t n){ pending.assign(n, std::string_view()); }
+            void set(size_t slot, std::string_view key){ pending[slot] = key; }
+            void finish(size_t n){
+                offsets.assign(1, 0);
+                for(size_t slot = 0; slot < n; ++slot){
+                    chars.append(pending[slot]);
+                    offsets.push_back(chars.length());
+                }
+                pending = std::vector< std::string_view >();
+            }
+            std::string_view get(size_t slot) const {
+                return std::string_view(chars.data() + offsets[slot], offsets[slot+1] - offsets[slot]);
+            }
+        };
+
+        //A minimal perfect hash table of distinct keys: each key has its own
+        //slot, found with one hash of the key and a lookup of its bucket's seed.
+        //Buckets of several keys have a seed that sends each of them to a free
+        //slot; buckets of a single key store its slot directly.
+        template<size_t N>
+        class frozen_table {
+        private:
+            size_t n;
+            frozen_array< int32_t, N > seeds;   //per bucket: 0 (empty), a seed, or -(slot + 1)
+            frozen_array< size_t, N > lengths;  //the distinct key lengths, longest first
+            size_t num_lengths;
+            frozen_keys< N > keys;
+
+        public:
+            static constexpr size_t none = SIZE_MAX;
+
+            constexpr frozen_table() : n(0), seeds(), lengths(), num_lengths(0), keys() {}
+
+            //Builds the table, and sets slot[i] to the slot of keys[i]
+            template<typename Keys, typename Slots>
+            constexpr void build(const Keys& key_list, size_t count, Slots& slot){
+                n = count;
+                seeds = frozen_alloc<int32_t, N>(n);
+                lengths = frozen_alloc<size_t, N>(n);
+                keys.init(n);
+
+                auto hash  = frozen_alloc<uint64_t, N>(n);
+                auto size  = frozen_alloc<uint32_t, N>(n);
+                auto start = frozen_alloc<uint32_t, N>(n);
+                auto order = frozen_alloc<uint32_t, N>(n);
+                auto taken = frozen_alloc<bool, N>(n);
+
+                //Group the keys by bucket
+                uint32_t max_size = 0;
+                for(size_t i = 0; i < n; ++i){
+                    hash[i] = frozen_hash(key_list[i]);
+                    uint32_t b = hash[i] % n;
+                    if(++size[b] > max_size)
+                        max_size = size[b];
+                }
+                for(size_t b = 1; b < n; ++b)
+                    start[b] = start[b-1] + size[b-1];
+                for(size_t i = 0; i < n; ++i){
+                    uint32_t b = hash[i] % n;
+                    order[start[b]++] = i;
+                }
+                for(size_t b = 0; b < n; ++b)
+                    start[b] -= size[b];
+
+                //Largest buckets first, while most slots are free
+                for(uint32_t s = max_size; s >= 2; --s){
+                    for(size_t b = 0; b < n; ++b){
+                        if(size[b] != s)
+                            continue;
+
+                        for(int32_t seed = 1; ; ++seed){
+                            uint32_t placed = 0;
+                            for(; placed < s; ++placed){
+                                size_t at = frozen_mix(hash[order[start[b] + placed]], seed) % n;
+                                if(taken[at])
+                                    break;
+                                taken[at] = true;
+                            }
+                            if(placed == s){
+                                seeds[b] = seed;
+                                break;
+                            }
+                            while(placed-- > 0)
+                                taken[frozen_mix(hash[order[start[b] + placed]], seed) % n] = false;
+                        }
+
+                        for(uint32_t j = 0; j < s; ++j){
+                            uint32_t i = order[start[b] + j];
+                            slot[i] = frozen_mix(hash[i], seeds[b]) % n;
+                        }
+                    }
+                }
+
+                size_t free_slot = 0;
+                for(size_t b = 0; b < n; ++b){
+                    if(size[b] != 1)
+                        continue;
+                    while(taken[free_slot])
+                        ++free_slot;
+                    taken[free_slot] = true;
+                    seeds[b] = -int32_t(free_slot) - 1;
+                    slot[order[start[b]]] = free_slot;
+                }
+
+                for(size_t i = 0; i < n; ++i){
+                    keys.set(slot[i], key_list[i]);
+
+                    size_t len = key_list[i].length();
+                    size_t k = 0;
+                    while(k < num_lengths && lengths[k] > len)
+                        ++k;
+                    if(k < num_lengths && lengths[k] == len)
+                        continue;
+                    for(size_t j = num_lengths; j > k; --j)
+                        lengths[j] = lengths[j-1];
+                    lengths[k] = len;
+                    ++num_lengths;
+                }
+                keys.finish(n);
+            }
+
+            constexpr size_t size() const { return n; }
+            constexpr std::string_view key(size_t slot) const { return keys.get(slot); }
+
+            //The slot of a key, or none
+            constexpr size_t find(std::string_view key) const {
+                if(n == 0)
+                    return none;
+
+                size_t slot = frozen_slot(seeds, n, frozen_hash(key));
+                return keys.get(slot) == key ? slot : none;
+            }
+
+            //The slot and length of the longest key at a position, or none and npos
+            std::pair<size_t, size_t> match(std::string_view str, size_t pos, bool whole_word) const {
+                return frozen_match(str, pos, whole_word, lengths, num_lengths,
+                                    [this](std::string_view key){ return find(key); });
+            }
+
+            //The tables, to be written into an image
+            frozen_image_parts image_parts() const {
+                static_assert(N == 0, "Only frozen sets and maps built at run time can be saved");
+
+                frozen_image_parts parts = {};
+                parts.count       = n;
+                parts.seeds       = seeds.data();
+                parts.lengths     = lengths.data();
+                parts.num_lengths = num_lengths;
+                parts.key_offsets = keys.offsets.empty() ? nullptr : keys.offsets.data();
+                parts.key_chars   = keys.chars;
+                return parts;
+            }
+        };
+
+    }
+
+    /**
+     * @brief A read-only @c keyword_set, stored in a minimal perfect hash table.
+     *
+     * Looking up a whole string hashes it once, reads its bucket's seed and
+     * compares it with the single key that could be equal to it, so there is
+     * at most one probe of the (contiguously stored) keys. Positional matches
+     * try each distinct keyword length, longest first, without allocating.
+     *
+     * A frozen set is either made from a @c keyword_set by @c freeze(), or
+     * built at compile time by @c make_frozen_keyword_set from a list of
+     * constant strings (such as literals), which are not copied.
+     *
+     * @tparam N the number of keywords if known at compile time, or 0.
+     */
+    template<size_t N = 0>
+    class frozen_keyword_set {
+    private:
+        detail::frozen_table<N> table;
+
+    public:
+        constexpr frozen_keyword_set() : table() {}
+
+        /**
+         * @brief Builds the set from a list of keywords. Duplicates are ignored,
+         * unless @p distinct promises that there are none (skipping the check).
+         */
+        template<typename Keys>
+        constexpr frozen_keyword_set(const Keys& keys, size_t count, bool distinct = false) : table() {
+            auto unique = detail::frozen_alloc<std::string_view, N>(count);
+            size_t n = 0;
+            if constexpr (N == 0){
+                if(!distinct){
+                    for(auto [first, last] : detail::frozen_distinct(keys, count))
+                        unique[n++] = keys[first];
+                }
+            }
+            if(N > 0 || distinct){
+                //Compile-time lists are short enough to compare every pair
+                for(size_t i = 0; i < count; ++i){
+                    bool seen = false;
+                    for(size_t j = 0; j < n && !distinct && !seen; ++j)
+                        seen = (unique[j] == std::string_view(keys[i]));
+                    if(!seen)
+                        unique[n++] = keys[i];
+                }
+            }
+
+            auto slot = detail::frozen_alloc<size_t, N>(n);
+            table.build(unique, n, slot);
+        }
+
+        constexpr size_t size() const { return table.size(); }
+
+        /** @brief Like @c keyword_set::match. */
+        size_t match(std::string_view str, size_t pos = 0, bool whole_word = true) const {
+            return table.match(str, pos, whole_word).second;
+        }
+
+        /** @brief Like @c keyword_set::match_whole. */
+        constexpr size_t match_whole(std::string_view str) const {
+            return table.find(str) != table.none ? str.length() : std::string::npos;
+        }
+
+        constexpr bool contains(std::string_view str) const { return table.find(str) != table.none; }
+
+        /**
+         * @brief Writes the set to a file, which @c mapped_keyword_set can
+         * open without building anything (see keyword_image.hpp).
+         */
+        void save(const std::string& filename) const {
+            detail::frozen_image_parts parts = table.image_parts();
+            parts.value_kind = detail::frozen_no_values;
+            detail::write_frozen_image(filename, parts);
+        }
+    };
+
+    /**
+     * @brief A read-only @c keyword_map, stored like a @c frozen_keyword_set,
+     * with the values in one array in the same order as the keys.
+     *
+     * @tparam T the type of the values. For compile-time maps, it must be
+     *      usable in constant expressions.
+     * @tparam N the number of keywords if known at compile time, or 0.
+     */
+    template<typename T, size_t N = 0>
+    class frozen_keyword_map {
+    private:
+        detail::frozen_table<N> table;
+        detail::frozen_array<T, N> values;
+
+    public:
+        using value_type = T;
+
+        constexpr frozen_keyword_map() : table(), values() {}
+
+        /**
+         * @brief Builds the map from lists of keywords and their values. If a
+         * keyword is listed several times, the last value is kept, unless
+         * @p distinct promises that there are no duplicates (skipping the check).
+         */
+        template<typename Keys, typename Values>
+        constexpr frozen_keyword_map(const Keys& keys, const Values& vals, size_t count, bool distinct = false)
+         : table(), values()
+        {
+            auto unique = detail::frozen_alloc<std::string_view, N>(count);
+            auto index = detail::frozen_alloc<size_t, N>(count);
+            size_t n = 0;
+            if constexpr (N == 0){
+                if(!distinct){
+                    for(auto [first, last] : detail::frozen_distinct(keys, count)){
+                        unique[n] = keys[first];
+                        index[n++] = last;
+                    }
+                }
+            }
+            if(N > 0 || distinct){
+                //Compile-time lists are short enough to compare every pair
+                for(size_t i = 0; i < count; ++i){
+                    size_t j = distinct ? n : 0;
+                    while(j < n && unique[j] != std::string_view(keys[i]))
+                        ++j;
+                    if(j == n)
+                        unique[n++] = keys[i];
+                    index[j] = i;
+                }
+            }
+
+            auto slot = detail::frozen_alloc<size_t, N>(n);
+            table.build(unique, n, slot);
+
+            values = detail::frozen_alloc<T, N>(n);
+            for(size_t j = 0; j < n; ++j)
+                values[slot[j]] = vals[index[j]];
+        }
+
+        constexpr size_t size() const { return table.size(); }
+
+        /**
+         * @brief Like @c keyword_map::match, but returns a pointer to the
+         * matching value, or @c nullptr if there was no match.
+         */
+        std::pair<const value_type*, size_t>
+        match(std::string_view str, size_t pos = 0, bool whole_word = true) const {
+            auto [slot, len] = table.match(str, pos, whole_word);
+            return std::make_pair(slot != table.none ? &values[slot] : nullptr, len);
+        }
+
+        /** @brief Like @c match, but matches against the full string. */
+        constexpr std::pair<const value_type*, size_t> match_whole(std::string_view str) const {
+            size_t slot = table.find(str);
+            if(slot == table.none)
+                return std::make_pair(nullptr, std::string::npos);
+            return std::make_pair(&values[slot], str.length());
+        }
+
+        /** @brief The value of a keyword, or @p otherwise if it is not in the map. */
+        constexpr value_type get(std::string_view str, value_type otherwise = value_type()) const {
+            size_t slot = table.find(str);
+            return slot != table.none ? values[slot] : otherwise;
+        }
+
+        /**
+         * @brief Writes the map to a file, which @c mapped_keyword_map can
+         * open without building anything (see keyword_image.hpp). The values
+         * must be trivially copyable, and are written as they are in memory,
+         * or be @c std::string.
+         */
+        void save(const std::string& filename) const {
+            static_assert(std::is_trivially_copyable_v<T> || std::is_same_v<T, std::string>,
+                          "Only trivially copyable values and strings can be saved");
+
+            detail::frozen_image_parts parts = table.image_parts();
+            std::string bytes;
+            std::vector< uint32_t > offsets;
+
+            if constexpr (std::is_same_v<T, std::string>){
+                offsets.push_back(0);
+                for(const std::string& value : values){
+                    bytes.append(value);
+                    offsets.push_back(bytes.length());
+                }
+                parts.value_kind = detail::frozen_string_values;
+                parts.value_offsets = offsets.data();
+            }
+            else {
+                //Copied one by one, as std::vector<bool> has no array of them
+                bytes.resize(values.size() * sizeof(T));
+                for(size_t slot = 0; slot < values.size(); ++slot){
+                    T value = values[slot];
+                    std::memcpy(&bytes[slot * sizeof(T)], &value, sizeof(T));
+                }
+                parts.value_kind = detail::frozen_fixed_values;
+                parts.value_size = sizeof(T);
+                parts.value_align = alignof(T);
+            }
+
+            parts.values = bytes;
+            detail::write_frozen_image(filename, parts);
+        }
+    };
+
+    /**
+     * @brief Builds a @c frozen_keyword_set at compile time, as in
+     * @code
+     * constexpr auto literals = util::make_frozen_keyword_set({"true", "false", "null"});
+     * @endcode
+     */
+    template<size_t N>
+    constexpr frozen_keyword_set<N> make_frozen_keyword_set(const std::string_view (&keys)[N]){
+        return frozen_keyword_set<N>(keys, N);
+    }
+
+    /**
+     * @brief Builds a @c frozen_keyword_map at compile time, as in
+     * @code
+     * constexpr auto literals = util::make_frozen_keyword_map<int>({{"true", 1}, {"false", 0}});
+     * @endcode
+     */
+    template<typename T, size_t N>
+    constexpr frozen_keyword_map<T, N> make_frozen_keyword_map(const std::pair<std::string_view, T> (&items)[N]){
+        std::array< std::string_view, N > keys{};
+        std::array< T, N > vals{};
+        for(size_t i = 0; i < N; ++i){
+            keys[i] = items[i].first;
+            vals[i] = items[i].second;
+        }
+        return frozen_keyword_map<T, N>(keys, vals, N);
+    }
+
+};
+
+#endif
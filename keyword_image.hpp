@@ -0,0 +1,212 @@
+#ifndef UTIL_KEYWORD_IMAGE_H
+#define UTIL_KEYWORD_IMAGE_H
+
+#ifndef UTIL_KEYWORD_IMAGE_ERROR_THROW
+#    define UTIL_KEYWORD_IMAGE_ERROR_THROW 0
+#endif
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "frozen_keyword_map.hpp"
+
+#if UTIL_KEYWORD_IMAGE_ERROR_THROW
+#include <stdexcept>
+
+namespace util {
+    class keyword_image_error : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+};
+
+#endif
+
+namespace util {
+
+    namespace detail {
+
+        //An image written by frozen_keyword_set::save or frozen_keyword_map::save,
+        //mapped into memory and looked up in place. The
+        //image consists of a header and the tables of the frozen set or map,
+        //which refer to each other only by offsets, so nothing needs to be
+        //built or relocated when opening it. Opening checks the header, and
+        //that the tables lie within the image; verifying also compares the
+        //checksum of the whole image, which reads all of it.
+        class keyword_image {
+        private:
+            const char* data;
+            size_t length;
+            bool mapped;
+
+            size_t n;
+            size_t num_lengths;
+            const int32_t* seeds;
+            const uint64_t* lengths;
+            const uint32_t* key_offsets;
+            const char* key_chars;
+            const char* values;
+            const uint32_t* value_offsets;
+
+            //Checks the image and finds its tables; returns what is wrong, if anything
+            std::string load(frozen_value_kind kind, size_t value_size, size_t value_align, bool verify);
+            void release();
+
+        public:
+            static constexpr size_t none = SIZE_MAX;
+
+            keyword_image(const std::string& filename, frozen_value_kind kind,
+                          size_t value_size, size_t value_align, bool verify);
+
+            keyword_image(const keyword_image&) = delete;
+            keyword_image(keyword_image&& other) noexcept;
+            ~keyword_image();
+
+            keyword_image& operator= (const keyword_image&) = delete;
+            keyword_image& operator= (keyword_image&& other) noexcept;
+
+            size_t size() const { return n; }
+
+            std::string_view key(size_t slot) const {
+                return std::string_view(key_chars + key_offsets[slot], key_offsets[slot+1] - key_offsets[slot]);
+            }
+
+            //The slot of a key, or none
+            size_t find(std::string_view key) const {
+                if(n == 0)
+                    return none;
+
+                size_t slot = frozen_slot(seeds, n, frozen_hash(key));
+                return this->key(slot) == key ? slot : none;
+            }
+
+            //The slot and length of the longest key at a position, or none and npos
+            std::pair<size_t, size_t> match(std::string_view str, size_t pos, bool whole_word) const {
+                return frozen_match(str, pos, whole_word, lengths, num_lengths,
+                                    [this](std::string_view key){ return find(key); });
+            }
+
+            template<typename T>
+            const T* value(size_t slot) const { return reinterpret_cast<const T*>(values) + slot; }
+
+            std::string_view string_value(size_t slot) const {
+                return std::string_view(values + value_offsets[slot], value_offsets[slot+1] - value_offsets[slot]);
+            }
+        };
+
+    }
+
+    /**
+     * @brief A @c frozen_keyword_set opened from the file written by its
+     * @c save(), which is mapped into memory and looked up in place.
+     *
+     * Opening the set does not hash, copy or allocate anything, so it takes
+     * the same (short) time for any number of keywords; the pages of the
+     * file are read as lookups need them, and are shared by all processes
+     * mapping the same file.
+     *
+     * The file is in native byte order, and is only accepted by the same
+     * version of this format. To replace it while it is mapped, save to
+     * another file and rename that over it. Errors (a missing file, or one
+     * that is not a valid image) are reported by printing a message and
+     * exiting, or by throwing a @c keyword_image_error if
+     * @c UTIL_KEYWORD_IMAGE_ERROR_THROW is set.
+     */
+    class mapped_keyword_set {
+    private:
+        detail::keyword_image image;
+
+    public:
+        /**
+         * @brief Maps the file written by @c frozen_keyword_set::save.
+         *
+         * @param verify whether to compare the checksum of the file, which
+         *      reads all of it. Lookups in an unverified, corrupted file may
+         *      give wrong results or read out of bounds.
+         */
+        explicit mapped_keyword_set(const std::string& filename, bool verify = true)
+         : image(filename, detail::frozen_no_values, 0, 0, verify) {}
+
+        size_t size() const { return image.size(); }
+
+        /** @brief Like @c keyword_set::match. */
+        size_t match(std::string_view str, size_t pos = 0, bool whole_word = true) const {
+            return image.match(str, pos, whole_word).second;
+        }
+
+        /** @brief Like @c keyword_set::match_whole. */
+        size_t match_whole(std::string_view str) const {
+            return image.find(str) != image.none ? str.length() : std::string::npos;
+        }
+
+        bool contains(std::string_view str) const { return image.find(str) != image.none; }
+    };
+
+    /**
+     * @brief A @c frozen_keyword_map opened from the file written by its
+     * @c save(), like a @c mapped_keyword_set.
+     *
+     * The values are not copied either: lookups return pointers to them
+     * within the file, or views of them for @c std::string values. The
+     * image records the size of the values, but not their type, which must
+     * be the same as when it was saved.
+     *
+     * @tparam T the type of the values, which must be trivially copyable,
+     *      or @c std::string.
+     */
+    template<typename T>
+    class mapped_keyword_map {
+    private:
+        static constexpr bool strings = std::is_same_v<T, std::string>;
+
+        static_assert(std::is_trivially_copyable_v<T> || strings,
+                      "Only trivially copyable values and strings can be mapped");
+
+        detail::keyword_image image;
+
+    public:
+        using value_type = T;
+
+        /** @brief What lookups return for a value: a pointer to it, or a view of a string. */
+        using value_ref = std::conditional_t<strings, std::string_view, const T*>;
+
+    private:
+        value_ref value(size_t slot) const {
+            if constexpr (strings)
+                return slot != image.none ? image.string_value(slot) : std::string_view();
+            else
+                return slot != image.none ? image.value<T>(slot) : nullptr;
+        }
+
+    public:
+        /** @brief Maps the file written by @c frozen_keyword_map::save; see @c mapped_keyword_set. */
+        explicit mapped_keyword_map(const std::string& filename, bool verify = true)
+         : image(filename, strings ? detail::frozen_string_values : detail::frozen_fixed_values,
+                 strings ? 0 : sizeof(T), strings ? 0 : alignof(T), verify) {}
+
+        size_t size() const { return image.size(); }
+
+        /**
+         * @brief Like @c keyword_map::match, but returns the matching value
+         * as a @c value_ref, which is null (or empty) if there was no match.
+         */
+        std::pair<value_ref, size_t> match(std::string_view str, size_t pos = 0, bool whole_word = true) const {
+            auto [slot, len] = image.match(str, pos, whole_word);
+            return std::make_pair(value(slot), len);
+        }
+
+        /** @brief Like @c match, but matches against the full string. */
+        std::pair<value_ref, size_t> match_whole(std::string_view str) const {
+            size_t slot = image.find(str);
+            return std::make_pair(value(slot), slot != image.none ? str.length() : std::string::npos);
+        }
+
+        bool contains(std::string_view str) const { return image.find(str) != image.none; }
+    };
+
+};
+
+#endif
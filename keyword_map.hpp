@@ -2,10 +2,15 @@
 #define UTIL_KEYWORD_MAP_H
 
 #include <algorithm>
-#include <map>
-#include <unordered_map>
+#include <initializer_list>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <type_traits>
+#include <vector>
 
-#include "char_utils.hpp"
+#include "frozen_keyword_map.hpp"
+#include "keyword_trie.hpp"
 
 namespace util{
     /**
@@ -15,41 +20,115 @@ namespace util{
      * substituted for the keywords in the string. Otherwise, the behaviour and 
      * performance is very similar to @c keyword_set.
      * 
+     * Each keyword gets a small integer id when it is inserted, which it keeps
+     * until it is erased; the ids of erased keywords are given to the next ones
+     * inserted. Lookups return ids, and the values are stored in one array
+     * indexed by them, so other tables about the keywords can be arrays indexed
+     * by the same ids. As with @c std::vector, inserting may move the values.
+     * 
+     * The map allocates from a @c std::pmr::memory_resource, like a
+     * @c keyword_set; values that take an allocator, such as
+     * @c std::pmr::string, allocate from it too.
+     * 
      * @tparam T the type of the values. Must be default-constructible.
      */
     template<typename T>
     class keyword_map {
-    private:
+    public:
         using value_type = T;
-        using internal_map = std::unordered_map<std::string, value_type>;
         
-        size_t max_len;
-        std::map<size_t, internal_map, std::greater<size_t>> map;
+        /** @brief The id returned by lookups that found no keyword. */
+        static constexpr uint32_t none = detail::keyword_trie::none;
+        
+    private:
+        detail::keyword_trie trie;
+        
+        //A std::vector<bool> packs its bits, and has no bool& to give out
+        struct bool_value {
+            bool value;
+            bool_value(bool value = false) : value(value) {}
+        };
+        using stored_type = std::conditional_t<std::is_same_v<T, bool>, bool_value, T>;
+        
+        std::pmr::vector<stored_type> values;   //indexed by the ids in the trie
+        std::pmr::vector<uint32_t> free_ids;    //ids of erased keywords
+        
+        //Built when first needed, and shared by copies until they are changed
+        mutable std::shared_ptr<const detail::keyword_automaton> scanner;
+        
+        //The number of lookups of a batch done at once
+        static constexpr size_t batch_size = 64;
+        
+        std::pair<uint32_t, bool> add(std::string_view key, value_type&& val){
+            uint32_t id = free_ids.empty() ? values.size() : free_ids.back();
+            auto [found, added] = trie.insert(key, id);
+            if(!added)
+                return std::make_pair(found, false);
+            
+            scanner.reset();
+            if(id == values.size())
+                values.push_back(std::move(val));
+            else {
+                free_ids.pop_back();
+                values[id] = std::move(val);
+            }
+            return std::make_pair(id, true);
+        }
         
-        std::pair<typename internal_map::const_iterator, size_t> sentinel() const {
-            return std::make_pair(map.find(0)->second.end(), std::string::npos);
+        //Safe to call from several threads: only one of the automata built at
+        //once is kept, and it stays until the map is changed
+        const detail::keyword_automaton& get_scanner() const {
+            auto built = std::atomic_load(&scanner);
+            if(!built){
+                std::shared_ptr<const detail::keyword_automaton> fresh = std::allocate_shared<detail::keyword_automaton>(
+                    std::pmr::polymorphic_allocator<detail::keyword_automaton>(trie.resource()), trie);
+                if(std::atomic_compare_exchange_strong(&scanner, &built, fresh))
+                    built = fresh;
+            }
+            return *built;
         }
         
     public:
-        
         /** @brief Creates an empty keyword map. */
-        keyword_map() : max_len(0), map({{0, internal_map()}}) {}
+        keyword_map() : keyword_map(std::pmr::get_default_resource()) {}
+        
+        /** @brief Creates an empty keyword map allocating from @p resource. */
+        explicit keyword_map(std::pmr::memory_resource* resource)
+         : trie(resource), values(resource), free_ids(resource), scanner() {}
+        
+        keyword_map(const keyword_map& other) : keyword_map(other, std::pmr::get_default_resource()) {}
+        
+        //The automaton may be built by another thread scanning the original,
+        //and is only shared if it comes from the same resource
+        keyword_map(const keyword_map& other, std::pmr::memory_resource* resource)
+         : trie(other.trie, resource), values(other.values, resource), free_ids(other.free_ids, resource),
+           scanner(*other.trie.resource() == *resource ? std::atomic_load(&other.scanner) : nullptr) {}
+        keyword_map(keyword_map&&) = default;
+        
+        keyword_map& operator= (const keyword_map& other){ return *this = keyword_map(other, trie.resource()); }
+        
+        //Copies what comes from another resource into this map's
+        keyword_map& operator= (keyword_map&& other){
+            bool same = *trie.resource() == *other.trie.resource();
+            trie = std::move(other.trie);
+            values = std::move(other.values);
+            free_ids = std::move(other.free_ids);
+            scanner = same ? std::move(other.scanner) : nullptr;
+            return *this;
+        }
         
         /**
          * @brief Creates a keyword map from a list of keyword-value pairs
          * 
          * @param init an @c std::initializer_list containing the keyword-value pairs
          *      should initially be contained in the map.
+         * @param resource where to allocate the map's memory.
          */
-        keyword_map( std::initializer_list< std::pair<std::string, value_type> > init ) : max_len(0), map({{0, internal_map()}}) {
-            size_t len;
-            for(auto[key, val] : init){
-                len = key.length();
-                if(max_len < len)
-                    max_len = len;
-                
-                map[len][key] = val;
-            }
+        keyword_map( std::initializer_list< std::pair<std::string, value_type> > init,
+                     std::pmr::memory_resource* resource = std::pmr::get_default_resource() )
+         : keyword_map(resource) {
+            for(const auto& [key, val] : init)
+                (*this)[key] = val;
         }
         
         /**
@@ -62,8 +141,25 @@ namespace util{
          * If no value is associated with the keyword, a new one is created and
          * can be assigned to using the returned reference.
          */
-        value_type& operator[] (const std::string& key){
-            return map[key.length()][key];
+        value_type& operator[] (std::string_view key){
+            uint32_t id = trie.find(key);
+            if(id == none)
+                id = add(key, value_type()).first;
+            return value(id);
+        }
+        
+        /** @brief The value of the keyword with an id. */
+        value_type& value(uint32_t id){
+            if constexpr (std::is_same_v<T, bool>)
+                return values[id].value;
+            else
+                return values[id];
+        }
+        const value_type& value(uint32_t id) const {
+            if constexpr (std::is_same_v<T, bool>)
+                return values[id].value;
+            else
+                return values[id];
         }
         
         /**
@@ -71,99 +167,228 @@ namespace util{
          *
          * @param key_val the keyword-value pair.
          * 
-         * @return an iterator-bool pair. The iterator points to the keyword-value pair
-         *      corresponding to the provided keyword, and the bool is @c true if the
-         *      insertion actually happened. It is @c false if the value already existed,
-         *      in which case the value is not overwritten and the old value can be accessed
-         *      using the iterator. In/decrementing the iterator does not make much sense.
+         * @return an id-bool pair. The id is that of the provided keyword, and the
+         *      bool is @c true if the insertion actually happened. It is @c false if
+         *      the value already existed, in which case the value is not overwritten
+         *      and the old value can be accessed using the id.
          */
-        std::pair<typename internal_map::iterator, bool> 
+        std::pair<uint32_t, bool> 
         insert(const std::pair<std::string, value_type>& key_val){
-            size_t len = key_val.first.length();
-            if(len > max_len)
-                max_len = len;
-            return map[len].insert(key_val);
+            return add(key_val.first, value_type(key_val.second));
         }
-        std::pair<typename internal_map::iterator, bool> 
+        std::pair<uint32_t, bool> 
         insert(std::pair<std::string, value_type>&& key_val){
-            size_t len = key_val.first.length();
-            if(len > max_len)
-                max_len = len;
-            return map[len].insert(key_val);
+            return add(key_val.first, std::move(key_val.second));
         }
         
         /**
          * @brief Matches the substring at a specified location against the map.
          * 
-         * @param str the string containing the potential match.
+         * @param str the string containing the potential match, such as a slice
+         *      of a @c file_parser buffer or of mapped memory (it is not copied).
          * @param pos the position where the match should start.
          * @param whole_word if true, the keyword will only match if the characters
          *      before and after it are non-word characters 
          *      (or the beginning/end of the string).
          * 
          * If one keyword is a prefix of another, the longest possible match is always chosen.
+         * The match is found in a single walk over the string, without allocating anything.
          * 
-         * @return an iterator-integer pai. The integer is the length of the match, or 
+         * @return an id-integer pair. The integer is the length of the match, or 
          * @c std::string::npos if no keyword matched (like the corresponding return value 
-         * for @c keyword_set). The iterator points to the matching keyword-value pair
-         * if there was a match, and is unspecified if there was none.
+         * for @c keyword_set). The id is that of the matching keyword if there was a
+         * match, and @c none if there was none.
          */
-        std::pair<typename internal_map::const_iterator, size_t> 
-        match(const std::string& str, size_t pos = 0, bool whole_word = true) const {
-            if(whole_word && util::word_char(str, pos-1))
-                return sentinel();
-            
-            size_t max = std::min(max_len, str.length() - pos);
-            
-            for(auto it = map.lower_bound(max); it != map.end(); ++it){
-                const auto& [len, sub_map] = *it;
-                
-                if(whole_word && util::word_char(str, pos+len))
-                    continue;
-                
-                auto match = sub_map.find(str.substr(pos, len));
-                
-                if(match != sub_map.end())
-                    return std::make_pair(match, len);
-            }
-            
-            return sentinel();
+        std::pair<uint32_t, size_t> 
+        match(std::string_view str, size_t pos = 0, bool whole_word = true) const {
+            return trie.match(str, pos, whole_word);
         }   
         
         /**
          * @brief Like @c match, but matches against the full string.
          */
-        std::pair<typename internal_map::const_iterator, size_t> 
-        match_whole(const std::string& str) const {
-            auto it = map.find(str.length());
-            if(it != map.end()){
-                const auto& [len, sub_map] = *it;
-                
-                auto match = sub_map.find(str);
-                
-                if(match != sub_map.end())
-                    return std::make_pair(match, len);
+        std::pair<uint32_t, size_t> 
+        match_whole(std::string_view str) const {
+            uint32_t id = trie.find(str);
+            return std::make_pair(id, id != none ? str.length() : std::string::npos);
+        }
+        
+        /**
+         * @brief Like @c match_whole for many strings at once.
+         * 
+         * This is faster than looking up the strings one after the other:
+         * the walks of several strings are interleaved, so that while one waits
+         * for memory, the others can go on.
+         * 
+         * @param strs the strings to look up.
+         * @param count the number of strings.
+         * @param results set to the result of @c match_whole for each string.
+         */
+        void match_whole_batch(const std::string_view* strs, size_t count,
+                               std::pair<uint32_t, size_t>* results) const {
+            uint32_t ids[batch_size];
+            for(size_t base = 0; base < count; base += batch_size){
+                size_t n = std::min(batch_size, count - base);
+                trie.find_batch(strs + base, n, ids);
+                for(size_t j = 0; j < n; ++j)
+                    results[base + j] = std::make_pair(ids[j], ids[j] != none ? strs[base + j].length() : std::string::npos);
             }
-            return sentinel();
         }
         
+        /**
+         * @brief Like @c match at many positions at once, interleaved like
+         * @c match_whole_batch.
+         * 
+         * @param where the strings and the positions to match at in them.
+         * @param count the number of positions.
+         * @param results set to the result of @c match for each position.
+         * @param whole_word as for @c match.
+         */
+        void match_batch(const std::pair<std::string_view, size_t>* where, size_t count,
+                         std::pair<uint32_t, size_t>* results, bool whole_word = true) const {
+            trie.match_batch(where, count, whole_word, results);
+        }
+        
+        /**
+         * @brief Finds the keywords closest to a string, such as suggestions
+         * for a misspelled word.
+         * 
+         * The prefix tree is walked along with the edit distances between the
+         * string and the keyword so far, leaving each branch as soon as no
+         * keyword in it can be close enough. With few edits allowed, only a
+         * small part of the map is visited.
+         * 
+         * @param str the string.
+         * @param max_edits the maximum edit distance: the number of bytes to
+         *      insert, delete or replace to turn the string into a keyword.
+         * @param max_results the maximum number of keywords to return.
+         * 
+         * @return the keywords with their edit distances and ids, closest first
+         *      (and then in sorted order).
+         */
+        std::vector<fuzzy_match> match_fuzzy(std::string_view str, size_t max_edits = 2, size_t max_results = 10) const {
+            return detail::closest_keywords(trie, str, max_edits, max_results);
+        }
+        
+        /**
+         * @brief Finds the first keyword at or after a position, as the first
+         * one found by @c scan_all.
+         * 
+         * @param str the string to search.
+         * @param pos the position to start at.
+         * @param begin set to the position of the keyword, if one was found.
+         * @param len set to the length of the keyword, if one was found.
+         * @param whole_word as for @c match.
+         * 
+         * @return the id of the keyword, or @c none if no (non-empty) keyword was found.
+         */
+        uint32_t find(std::string_view str, size_t pos, size_t& begin, size_t& len, bool whole_word = true) const {
+            uint32_t found = none;
+            get_scanner().scan(trie, str, pos, whole_word, false, [&](size_t p, size_t l, uint32_t id){
+                begin = p;
+                len = l;
+                found = id;
+                return false;
+            });
+            return found;
+        }
+        
+        /**
+         * @brief Finds the keywords in a whole string in a single pass.
+         * 
+         * The string is scanned with an Aho-Corasick automaton built from the
+         * map, so the time taken does not depend on the number of keywords.
+         * The automaton is built by the first scan after the map was changed.
+         * The empty keyword is never found.
+         * 
+         * @param str the string to scan.
+         * @param f called as @c f(pos, len, value) with the position, length and
+         *      value of each keyword found, in order of the keywords' ends. If @p f
+         *      returns a @c bool, the scan stops as soon as it returns @c false.
+         * @param whole_word as for @c match.
+         * @param all if true, all keywords are found, even those overlapping or
+         *      contained in others; otherwise, only those that @c match would
+         *      find when moving past each match in turn (the leftmost-longest ones).
+         */
+        template<typename F>
+        void scan_all(std::string_view str, F f, bool whole_word = true, bool all = false) const {
+            get_scanner().scan(trie, str, 0, whole_word, all, [&](size_t pos, size_t len, uint32_t id){ return detail::scan_call(f, pos, len, value(id)); });
+        }
+        
+        /**
+         * @brief Like @c scan_all for a string, but scans the rest of a parser's
+         * input line by line, moving the parser to the end of each keyword before
+         * @p f is called with its column, length and value. Keywords can not span lines.
+         */
+        template<typename F>
+        void scan_all(file_parser& parser, F f, bool whole_word = true, bool all = false) const {
+            detail::scan_parser(trie, get_scanner(), parser, whole_word, all, [&](size_t pos, size_t len, uint32_t id){ return detail::scan_call(f, pos, len, value(id)); });
+        }
+        
+        /** @brief Number of keywords in the map. */
+        size_t size() const { return trie.size(); }
+        
+        /** @brief One more than the greatest id given to a keyword (erased or not). */
+        size_t id_count() const { return values.size(); }
+
+        /** @brief The memory resource that the map allocates from. */
+        std::pmr::memory_resource* get_memory_resource() const { return trie.resource(); }
+
+        /**
+         * @brief Makes a read-only copy of the map, stored in a minimal perfect
+         * hash table for faster whole-string lookups.
+         */
+        frozen_keyword_map<value_type> freeze() const {
+            std::vector<std::string> keys;
+            std::vector<value_type> vals;
+            keys.reserve(size());
+            vals.reserve(size());
+            for_each([&](const std::string& key, const value_type& val){
+                keys.push_back(key);
+                vals.push_back(val);
+            });
+            return frozen_keyword_map<value_type>(keys, vals, keys.size(), true);
+        }
+        
+        /**
+         * @brief Calls a function with every keyword and its value, in sorted order.
+         * If the function returns a @c bool, this stops as soon as it returns @c false.
+         */
+        template<typename F>
+        void for_each(F f) const {
+            trie.for_each([&](const std::string& key, uint32_t id){ return detail::scan_call(f, key, value(id)); });
+        }
+        
+        /**
+         * @brief Like @c for_each, but only for the keywords starting with a prefix,
+         * such as the completions of a partial word.
+         * 
+         * The keywords with the prefix are found below its end in the prefix tree,
+         * so the time taken depends on the length of the prefix and the number
+         * of keywords visited, but not on the size of the map.
+         */
+        template<typename F>
+        void for_each_with_prefix(std::string_view prefix, F f) const {
+            trie.for_each_prefix(prefix, [&](const std::string& key, uint32_t id){ return detail::scan_call(f, key, value(id)); });
+        }
+        
+        /** @brief Number of keywords starting with a prefix, counted like @c for_each_with_prefix. */
+        size_t count_with_prefix(std::string_view prefix) const { return trie.count_prefix(prefix); }
+        
         /**
          * @brief Erases a string from the map, if it exists.
          * @param key the string.
          * @return true if the string was contained in the map,
          *          false otherwise.
          */
-        bool erase(const std::string& key) {
-            auto it = map.find(key.length());
-            
-            if(it == map.end())
+        bool erase(std::string_view key) {
+            uint32_t id = trie.erase(key);
+            if(id == none)
                 return false;
             
-            if(it->second.size() == 1 && !key.empty())
-                map.erase(it);
-            else
-                it->second.erase(key);
-            
+            values[id] = value_type();
+            free_ids.push_back(id);
+            scanner.reset();
             return true;
         }
             
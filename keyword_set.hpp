@@ -2,10 +2,14 @@
 #define UTIL_KEYWORD_SET_H
 
 #include <algorithm>
-#include <map>
-#include <unordered_set>
+#include <initializer_list>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <vector>
 
-#include "char_utils.hpp"
+#include "frozen_keyword_map.hpp"
+#include "keyword_trie.hpp"
 
 namespace util {
 
@@ -16,35 +20,107 @@ namespace util {
      * 
      * This class supports a very limited number of operations. It is intended
      * to be constructed and filled with elements, and then used in a read-only fashion.
-     * Also, this very simple implementation is probably not as efficient as a prefix tree.
+     * The keywords are stored in a prefix tree, so the longest match is found
+     * in a single walk over the string, without allocating anything.
+     * 
+     * The tree, the automaton built for scanning and the table of the filter
+     * are allocated from a @c std::pmr::memory_resource, such as an arena
+     * released at the end of a parse. Like the @c std::pmr containers, a copy
+     * uses the default resource unless it is given another, and assigning
+     * keeps the resource of the set assigned to.
      */
     class keyword_set {
     private:
-        using internal_set = std::unordered_set<std::string>;
+        detail::keyword_trie trie;
+        
+        //Built when first needed, and shared by copies until they are changed
+        mutable std::shared_ptr<const detail::keyword_automaton> scanner;
         
-        size_t max_len;
-        std::map<size_t, internal_set, std::greater<size_t>> set;
+        //In front of whole-string lookups, if enabled
+        std::unique_ptr<detail::keyword_bloom> filter;
+        
+        //The number of lookups of a batch done at once
+        static constexpr size_t batch_size = 64;
+        
+        //Safe to call from several threads: only one of the automata built at
+        //once is kept, and it stays until the set is changed
+        const detail::keyword_automaton& get_scanner() const {
+            auto built = std::atomic_load(&scanner);
+            if(!built){
+                std::shared_ptr<const detail::keyword_automaton> fresh = std::allocate_shared<detail::keyword_automaton>(
+                    std::pmr::polymorphic_allocator<detail::keyword_automaton>(trie.resource()), trie);
+                if(std::atomic_compare_exchange_strong(&scanner, &built, fresh))
+                    built = fresh;
+            }
+            return *built;
+        }
+        
+        //Keeps the counts of a filter that is rebuilt
+        void build_filter(size_t capacity, double false_positive_rate){
+            std::unique_ptr<detail::keyword_bloom> fresh(new detail::keyword_bloom(capacity, false_positive_rate, trie.resource()));
+            trie.for_each([&](const std::string& key, uint32_t){ fresh->add(key); });
+            if(filter){
+                fresh->hits.store(filter->hits.load());
+                fresh->misses.store(filter->misses.load());
+                fresh->false_positives.store(filter->false_positives.load());
+            }
+            filter = std::move(fresh);
+        }
+        
+        size_t find_filtered(std::string_view str) const {
+            if(filter && !filter->may_contain(str))
+                return std::string::npos;
+            
+            bool found = trie.find(str) != detail::keyword_trie::none;
+            if(filter)
+                filter->passed(found);
+            return found ? str.length() : std::string::npos;
+        }
         
     public:
         
         /** @brief Creates an empty keyword set. */
-        keyword_set() : max_len(0), set() {}
+        keyword_set() : keyword_set(std::pmr::get_default_resource()) {}
+        
+        /** @brief Creates an empty keyword set allocating from @p resource. */
+        explicit keyword_set(std::pmr::memory_resource* resource) : trie(resource), scanner(), filter() {}
+        
+        keyword_set(const keyword_set& other) : keyword_set(other, std::pmr::get_default_resource()) {}
+        
+        //The automaton may be built by another thread scanning the original,
+        //and is only shared if it comes from the same resource
+        keyword_set(const keyword_set& other, std::pmr::memory_resource* resource)
+         : trie(other.trie, resource),
+           scanner(*other.trie.resource() == *resource ? std::atomic_load(&other.scanner) : nullptr),
+           filter(other.filter ? new detail::keyword_bloom(*other.filter, resource) : nullptr) {}
+        keyword_set(keyword_set&&) = default;
+        
+        keyword_set& operator= (const keyword_set& other){ return *this = keyword_set(other, trie.resource()); }
+        
+        //Copies what comes from another resource into this set's
+        keyword_set& operator= (keyword_set&& other){
+            bool same = *trie.resource() == *other.trie.resource();
+            trie = std::move(other.trie);
+            scanner = same ? std::move(other.scanner) : nullptr;
+            if(same || !other.filter)
+                filter = std::move(other.filter);
+            else
+                filter.reset(new detail::keyword_bloom(*other.filter, trie.resource()));
+            return *this;
+        }
         
         /**
          * @brief Creates a keyword set from a list of keywords
          * 
          * @param init an @c std::initializer_list containing the keywords that
          *      should initially be contained in the set.
+         * @param resource where to allocate the set's memory.
          */
-        keyword_set( std::initializer_list<std::string> init ) : max_len(0), set() {
-            size_t len;
-            for(auto key : init){
-                len = key.length();
-                if(max_len < len)
-                    max_len = len;
-                
-                set[len].insert(key);
-            }
+        keyword_set( std::initializer_list<std::string> init,
+                     std::pmr::memory_resource* resource = std::pmr::get_default_resource() )
+         : trie(resource), scanner(), filter() {
+            for(const auto& key : init)
+                trie.insert(key, 0);
         }
         
         /**
@@ -55,24 +131,24 @@ namespace util {
          * @return @c true if the keyword was actually inserted, @c false if it already existed
          *          (this has no significance for the behaviour of the set).
          */
-        bool insert(const std::string& key){
-            size_t len = key.length();
-            if(len > max_len)
-                max_len = len;
-            set[len].insert(key).second;
-        }
-        bool insert(std::string&& key){
-            size_t len = key.length();
-            if(len > max_len)
-                max_len = len;
-            set[len].insert(std::move(key)).second;
+        bool insert(std::string_view key){
+            if(!trie.insert(key, 0).second)
+                return false;
+            scanner.reset();
+            
+            if(filter && filter->full())
+                build_filter(2 * size(), filter->false_positive_rate());
+            else if(filter)
+                filter->add(key);
+            return true;
         }
         
         
         /**
          * @brief Matches the substring at a specified location against the set.
          * 
-         * @param str the string containing the potential match.
+         * @param str the string containing the potential match, such as a slice
+         *      of a @c file_parser buffer or of mapped memory (it is not copied).
          * @param pos the position where the match should start.
          * @param whole_word if true, the keyword will only match if the characters
          *      before and after it are non-word characters 
@@ -82,63 +158,244 @@ namespace util {
          * 
          * @return the length of the match, or @c std::string::npos if no keyword matched.
          */
-        size_t match(const std::string& str, size_t pos = 0, bool whole_word = true) const {
-            if(whole_word && util::word_char(str, pos-1))
-                std::string::npos;
-            
-            size_t max = std::min(max_len, str.length() - pos);
-            
-            for(auto it = set.lower_bound(max); it != set.end(); ++it){
-                const auto& [len, sub_map] = *it;
-                
-                if(whole_word && util::word_char(str, pos+len))
-                    continue;
-                
-                auto match = sub_map.find(str.substr(pos, len));
-                
-                if(match != sub_map.end())
-                    return len;
-            }
-            
-            return std::string::npos;
+        size_t match(std::string_view str, size_t pos = 0, bool whole_word = true) const {
+            return trie.match(str, pos, whole_word).second;
         }    
         
         /**
          * @brief Like @c match, but matches against the full string.
          */
-        size_t match_whole(const std::strng& str) const {
-            auto it = set.find(str.length());
-            if(it != set.end()){
-                const auto& [len, sub_map] = *it;
-                
-                auto match = sub_map.find(str);
+        size_t match_whole(std::string_view str) const {
+            return find_filtered(str);
+        }
+            
+        /**
+         * @brief Like @c match_whole for many strings at once.
+         * 
+         * This is faster than looking up the strings one after the other:
+         * the walks of several strings are interleaved, so that while one waits
+         * for memory, the others can go on.
+         * 
+         * @param strs the strings to look up.
+         * @param count the number of strings.
+         * @param results set to the result of @c match_whole for each string.
+         */
+        void match_whole_batch(const std::string_view* strs, size_t count, size_t* results) const {
+            std::string_view passed[batch_size];
+            size_t index[batch_size];
+            uint32_t ids[batch_size];
+            for(size_t base = 0; base < count; base += batch_size){
+                //Only look up what the filter lets through
+                size_t n = 0;
+                for(size_t j = base; j < count && j < base + batch_size; ++j){
+                    results[j] = std::string::npos;
+                    if(!filter || filter->may_contain(strs[j])){
+                        passed[n] = strs[j];
+                        index[n++] = j;
+                    }
+                }
                 
-                if(match != sub_map.end())
-                    return len;
+                trie.find_batch(passed, n, ids);
+                for(size_t j = 0; j < n; ++j){
+                    bool found = ids[j] != detail::keyword_trie::none;
+                    if(filter)
+                        filter->passed(found);
+                    if(found)
+                        results[index[j]] = passed[j].length();
+                }
             }
-            return std::string::npos;
         }
-            
+        
+        /**
+         * @brief Like @c match at many positions at once, interleaved like
+         * @c match_whole_batch.
+         * 
+         * @param where the strings and the positions to match at in them.
+         * @param count the number of positions.
+         * @param results set to the result of @c match for each position.
+         * @param whole_word as for @c match.
+         */
+        void match_batch(const std::pair<std::string_view, size_t>* where, size_t count,
+                         size_t* results, bool whole_word = true) const {
+            std::pair<uint32_t, size_t> found[batch_size];
+            for(size_t base = 0; base < count; base += batch_size){
+                size_t n = std::min(batch_size, count - base);
+                trie.match_batch(where + base, n, whole_word, found);
+                for(size_t j = 0; j < n; ++j)
+                    results[base + j] = found[j].second;
+            }
+        }
+        
+        /**
+         * @brief Finds the keywords closest to a string, such as suggestions
+         * for a misspelled word.
+         * 
+         * The prefix tree is walked along with the edit distances between the
+         * string and the keyword so far, leaving each branch as soon as no
+         * keyword in it can be close enough. With few edits allowed, only a
+         * small part of the set is visited.
+         * 
+         * @param str the string.
+         * @param max_edits the maximum edit distance: the number of bytes to
+         *      insert, delete or replace to turn the string into a keyword.
+         * @param max_results the maximum number of keywords to return.
+         * 
+         * @return the keywords with their edit distances, closest first
+         *      (and then in sorted order).
+         */
+        std::vector<fuzzy_match> match_fuzzy(std::string_view str, size_t max_edits = 2, size_t max_results = 10) const {
+            return detail::closest_keywords(trie, str, max_edits, max_results);
+        }
+        
+        /**
+         * @brief Finds the first keyword at or after a position, as the first
+         * one found by @c scan_all.
+         * 
+         * @param str the string to search.
+         * @param pos the position to start at.
+         * @param begin set to the position of the keyword, if one was found.
+         * @param len set to the length of the keyword, if one was found.
+         * @param whole_word as for @c match.
+         * 
+         * @return @c true if a (non-empty) keyword was found, @c false otherwise.
+         */
+        bool find(std::string_view str, size_t pos, size_t& begin, size_t& len, bool whole_word = true) const {
+            bool found = false;
+            get_scanner().scan(trie, str, pos, whole_word, false, [&](size_t p, size_t l, uint32_t){
+                begin = p;
+                len = l;
+                found = true;
+                return false;
+            });
+            return found;
+        }
+        
+        /**
+         * @brief Finds the keywords in a whole string in a single pass.
+         * 
+         * The string is scanned with an Aho-Corasick automaton built from the
+         * set, so the time taken does not depend on the number of keywords.
+         * The automaton is built by the first scan after the set was changed.
+         * The empty keyword is never found.
+         * 
+         * @param str the string to scan.
+         * @param f called as @c f(pos, len) with the position and length of each
+         *      keyword found, in order of the keywords' ends. If @p f
+         *      returns a @c bool, the scan stops as soon as it returns @c false.
+         * @param whole_word as for @c match.
+         * @param all if true, all keywords are found, even those overlapping or
+         *      contained in others; otherwise, only those that @c match would
+         *      find when moving past each match in turn (the leftmost-longest ones).
+         */
+        template<typename F>
+        void scan_all(std::string_view str, F f, bool whole_word = true, bool all = false) const {
+            get_scanner().scan(trie, str, 0, whole_word, all, [&](size_t pos, size_t len, uint32_t){ return detail::scan_call(f, pos, len); });
+        }
+        
+        /**
+         * @brief Like @c scan_all for a string, but scans the rest of a parser's
+         * input line by line, moving the parser to the end of each keyword before
+         * @p f is called with its column and length. Keywords can not span lines.
+         */
+        template<typename F>
+        void scan_all(file_parser& parser, F f, bool whole_word = true, bool all = false) const {
+            detail::scan_parser(trie, get_scanner(), parser, whole_word, all, [&](size_t pos, size_t len, uint32_t){ return detail::scan_call(f, pos, len); });
+        }
+        
         /**
          * @brief Erases a string from the set, if it exists.
          * @param key the string.
          * @return true if the string was contained in the set,
          *          false otherwise.
          */
-        bool erase(const std::string& key) {
-            auto it = map.find(key.length());
-            
-            if(it == map.end())
+        bool erase(std::string_view key) {
+            if(trie.erase(key) == detail::keyword_trie::none)
                 return false;
-            
-            if(it->second.size() == 1 && !key.empty())
-                map.erase(it);
-            else
-                it->second.erase(key);
-            
+            scanner.reset();
             return true;
         }
         
+        /**
+         * @brief Puts a Bloom filter in front of @c match_whole and
+         * @c match_whole_batch, for when most strings looked up are not keywords.
+         * 
+         * The filter rejects most of those by reading a single cache line of a
+         * bit array much smaller than the set, instead of walking the prefix tree.
+         * It takes about 1.2 * 1.44 * log2(1 / @p false_positive_rate) bits per
+         * keyword (12 for 1%). It is rebuilt twice as large whenever the set has
+         * doubled in size; erased keywords stay in it until then, letting more
+         * strings through.
+         * 
+         * @param false_positive_rate the fraction of the strings that are not
+         *      keywords that the filter should still let through.
+         */
+        void enable_filter(double false_positive_rate = 0.01){
+            filter.reset();
+            build_filter(2 * size(), false_positive_rate);
+        }
+        
+        /** @brief Removes the filter put in front of lookups by @c enable_filter. */
+        void disable_filter(){ filter.reset(); }
+        
+        /**
+         * @brief Counts of the whole-string lookups since the filter was enabled
+         * (or copied along with the set).
+         */
+        struct filter_stats {
+            uint64_t hits;              //keywords found
+            uint64_t misses;            //strings rejected by the filter
+            uint64_t false_positives;   //strings let through, but not found
+        };
+        
+        /** @brief The counts of lookups through the filter, which are all 0 if it is not enabled. */
+        filter_stats get_filter_stats() const {
+            if(!filter)
+                return {0, 0, 0};
+            return {filter->hits.load(), filter->misses.load(), filter->false_positives.load()};
+        }
+        
+        /** @brief Number of keywords in the set. */
+        size_t size() const { return trie.size(); }
+        
+        /** @brief The memory resource that the set allocates from. */
+        std::pmr::memory_resource* get_memory_resource() const { return trie.resource(); }
+        
+        /**
+         * @brief Makes a read-only copy of the set, stored in a minimal perfect
+         * hash table for faster whole-string lookups.
+         */
+        frozen_keyword_set<> freeze() const {
+            std::vector<std::string> keys;
+            keys.reserve(size());
+            for_each([&](const std::string& key){ keys.push_back(key); });
+            return frozen_keyword_set<>(keys, keys.size(), true);
+        }
+        
+        /**
+         * @brief Calls a function with every keyword, in sorted order.
+         * If the function returns a @c bool, this stops as soon as it returns @c false.
+         */
+        template<typename F>
+        void for_each(F f) const {
+            trie.for_each([&](const std::string& key, uint32_t){ return detail::scan_call(f, key); });
+        }
+        
+        /**
+         * @brief Like @c for_each, but only for the keywords starting with a prefix,
+         * such as the completions of a partial word.
+         * 
+         * The keywords with the prefix are found below its end in the prefix tree,
+         * so the time taken depends on the length of the prefix and the number
+         * of keywords visited, but not on the size of the set.
+         */
+        template<typename F>
+        void for_each_with_prefix(std::string_view prefix, F f) const {
+            trie.for_each_prefix(prefix, [&](const std::string& key, uint32_t){ return detail::scan_call(f, key); });
+        }
+        
+        /** @brief Number of keywords starting with a prefix, counted like @c for_each_with_prefix. */
+        size_t count_with_prefix(std::string_view prefix) const { return trie.count_prefix(prefix); }
+        
     };
 
 };
@@ -0,0 +1,678 @@
+#ifndef UTIL_KEYWORD_TRIE_H
+#define UTIL_KEYWORD_TRIE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "char_utils.hpp"
+#include "frozen_keyword_map.hpp"
+
+namespace util {
+
+    class file_parser;
+
+    /** @brief A keyword close to a string, as found by @c match_fuzzy. */
+    struct fuzzy_match {
+        std::string keyword;
+        size_t edits;       //the number of bytes to insert, delete or replace
+        uint32_t id;        //the id of the keyword in a @c keyword_map
+    };
+
+    namespace detail {
+
+        //Hints that some memory will be read soon
+        inline void keyword_prefetch(const void* p){
+#if defined(__GNUC__)
+            __builtin_prefetch(p);
+#else
+            (void) p;
+#endif
+        }
+
+        //Calls f with some arguments, and tells whether to go on: what f
+        //returns if that is a bool, and true otherwise
+        template<typename F, typename... Args>
+        bool scan_call(F& f, Args&&... args){
+            if constexpr (std::is_same_v< std::invoke_result_t<F&, Args...>, bool >)
+                return f(std::forward<Args>(args)...);
+            else {
+                f(std::forward<Args>(args)...);
+                return true;
+            }
+        }
+
+        //A prefix tree of keywords, each with an id, stored in one flat array of
+        //nodes. The children of a node form a list sorted by their byte, so that
+        //walking a string takes one step per byte and the keywords are enumerated
+        //in sorted order. Nodes freed by erasing keywords are reused. The nodes
+        //are allocated from a memory resource; copies use the default one,
+        //unless given another.
+        class keyword_trie {
+        public:
+            static constexpr uint32_t none = UINT32_MAX;
+
+            struct node {
+                uint32_t child;     //first child, or none
+                uint32_t sibling;   //next sibling (with a greater byte), or none; next free node if freed
+                uint32_t id;        //id of the keyword ending here, or none
+                unsigned char byte;
+            };
+
+        private:
+            std::pmr::vector< node > nodes;     //the root is nodes[0]
+            uint32_t free_nodes;
+            size_t count;
+
+            uint32_t new_node(unsigned char byte){
+                uint32_t n = free_nodes;
+                if(n != none){
+                    free_nodes = nodes[n].sibling;
+                    nodes[n] = {none, none, none, byte};
+                }
+                else {
+                    n = nodes.size();
+                    nodes.push_back({none, none, none, byte});
+                }
+                return n;
+            }
+
+            //Calls f(key, id) for the keywords below node n, whose key is the
+            //one so far, in sorted order. Walks with a stack of the nodes
+            //below n on the current path rather than by recursion, as keys may
+            //be far longer than the call stack is deep.
+            template<typename F>
+            bool visit(uint32_t n, std::string& key, F& f) const {
+                if(nodes[n].id != none && !scan_call(f, const_cast<const std::string&>(key), nodes[n].id))
+                    return false;
+
+                size_t depth = key.length();
+                std::vector< uint32_t > path;
+                uint32_t k = nodes[n].child;
+                for(;;){
+                    if(k == none){
+                        if(path.empty())
+                            return true;
+                        k = nodes[path.back()].sibling;
+                        path.pop_back();
+                        key.pop_back();
+                        continue;
+                    }
+
+                    key.push_back(nodes[k].byte);
+                    if(nodes[k].id != none && !scan_call(f, const_cast<const std::string&>(key), nodes[k].id)){
+                        key.resize(depth);
+                        return false;
+                    }
+                    path.push_back(k);
+                    k = nodes[k].child;
+                }
+            }
+
+            //Walks below node n (at depth d) as long as some prefix of str is
+            //within max_edits of the key so far. rows holds a row for each
+            //depth: the edit distances between the key so far and each
+            //prefix of str, computed from the row above it. Only the prefixes
+            //that are at most max_edits shorter or longer than the key can be
+            //close enough; the distances to the others stay at max_edits + 1.
+            template<typename F>
+            bool visit_fuzzy(uint32_t n, size_t d, std::string& key, std::string_view str, size_t max_edits,
+                             std::vector<size_t>& rows, F& f) const {
+                const size_t width = str.length() + 1;
+                const size_t* row = &rows[d * width];
+
+                if(nodes[n].id != none && row[str.length()] <= max_edits
+                   && !f(const_cast<const std::string&>(key), nodes[n].id, row[str.length()]))
+                    return false;
+
+                if(d + 1 > str.length() + max_edits)
+                    return true;
+
+                size_t* next = &rows[(d + 1) * width];
+                size_t lo = d + 1 > max_edits ? d + 1 - max_edits : 0;
+                size_t hi = std::min(str.length(), d + 1 + max_edits);
+
+                for(uint32_t k = nodes[n].child; k != none; k = nodes[k].sibling){
+                    char byte = nodes[k].byte;
+                    size_t least = max_edits + 1;
+                    for(size_t i = lo; i <= hi; ++i){
+                        next[i] = (i == 0) ? d + 1 : std::min({row[i] + 1, (i > lo ? next[i-1] : max_edits) + 1,
+                                                               row[i-1] + (str[i-1] != byte)});
+                        least = std::min(least, next[i]);
+                    }
+                    if(least > max_edits)
+                        continue;
+
+                    key.push_back(byte);
+                    bool go_on = visit_fuzzy(k, d + 1, key, str, max_edits, rows, f);
+                    key.pop_back();
+                    if(!go_on)
+                        return false;
+                }
+                return true;
+            }
+
+            //Without recursion, like visit
+            size_t count_below(uint32_t n) const {
+                size_t found = nodes[n].id != none;
+                std::vector< uint32_t > pending;
+                if(nodes[n].child != none)
+                    pending.push_back(nodes[n].child);
+                while(!pending.empty()){
+                    uint32_t k = pending.back();
+                    pending.pop_back();
+                    found += nodes[k].id != none;
+                    if(nodes[k].sibling != none)
+                        pending.push_back(nodes[k].sibling);
+                    if(nodes[k].child != none)
+                        pending.push_back(nodes[k].child);
+                }
+                return found;
+            }
+
+            //Walks along several strings at once, one byte of each in turn, so
+            //that the cache misses of the walks overlap instead of following
+            //each other: the first child of the next node of each walk is
+            //prefetched while the others take their steps. Calls
+            //visit(j, n, len) at each node n reached by the first len bytes
+            //of the j-th string, str(j), and stops that walk if it returns false.
+            template<typename Str, typename Visit>
+            void walk_batch(size_t total, Str str, Visit visit) const {
+                constexpr size_t group = 16;
+                std::string_view rest[group];
+                uint32_t child[group];
+                size_t depth[group];
+                size_t lanes[group];
+
+                for(size_t base = 0; base < total; base += group){
+                    size_t active = 0;
+                    for(size_t j = 0; j < group && base + j < total; ++j){
+                        rest[j] = str(base + j);
+                        depth[j] = 0;
+                        child[j] = nodes[0].child;
+                        if(visit(base + j, 0, 0) && !rest[j].empty() && child[j] != none)
+                            lanes[active++] = j;
+                    }
+
+                    while(active > 0){
+                        size_t still = 0;
+                        for(size_t a = 0; a < active; ++a){
+                            size_t j = lanes[a];
+                            unsigned char byte = rest[j][depth[j]];
+
+                            uint32_t k = child[j];
+                            while(k != none && nodes[k].byte < byte)
+                                k = nodes[k].sibling;
+                            if(k == none || nodes[k].byte != byte)
+                                continue;
+
+                            ++depth[j];
+                            if(!visit(base + j, k, depth[j]) || depth[j] == rest[j].length() || nodes[k].child == none)
+                                continue;
+
+                            child[j] = nodes[k].child;
+                            keyword_prefetch(&nodes[child[j]]);
+                            lanes[still++] = j;
+                        }
+                        active = still;
+                    }
+                }
+            }
+
+        public:
+            explicit keyword_trie(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+             : nodes(1, node{none, none, none, 0}, resource), free_nodes(none), count(0) {}
+
+            keyword_trie(const keyword_trie& other, std::pmr::memory_resource* resource)
+             : nodes(other.nodes, resource), free_nodes(other.free_nodes), count(other.count) {}
+
+            std::pmr::memory_resource* resource() const { return nodes.get_allocator().resource(); }
+
+            size_t size() const { return count; }
+            size_t node_count() const { return nodes.size(); }
+            const node& at(uint32_t n) const { return nodes[n]; }
+
+            //The child of node n for a byte, or none
+            uint32_t step(uint32_t n, unsigned char byte) const {
+                uint32_t k = nodes[n].child;
+                while(k != none && nodes[k].byte < byte)
+                    k = nodes[k].sibling;
+                return (k != none && nodes[k].byte == byte) ? k : none;
+            }
+
+            //Adds a keyword with an id, unless it exists already.
+            //Returns the keyword's id, and whether it was added.
+            std::pair<uint32_t, bool> insert(std::string_view key, uint32_t id){
+                uint32_t n = 0;
+                for(char ch : key){
+                    unsigned char byte = ch;
+
+                    uint32_t prev = none;
+                    uint32_t k = nodes[n].child;
+                    while(k != none && nodes[k].byte < byte){
+                        prev = k;
+                        k = nodes[k].sibling;
+                    }
+
+                    if(k == none || nodes[k].byte != byte){
+                        uint32_t m = new_node(byte);
+                        nodes[m].sibling = k;
+                        if(prev == none)
+                            nodes[n].child = m;
+                        else
+                            nodes[prev].sibling = m;
+                        k = m;
+                    }
+                    n = k;
+                }
+
+                if(nodes[n].id != none)
+                    return {nodes[n].id, false};
+
+                nodes[n].id = id;
+                ++count;
+                return {id, true};
+            }
+
+            //The node reached by the bytes of a key, or none
+            uint32_t descend(std::string_view key) const {
+                uint32_t n = 0;
+                for(size_t i = 0; i < key.length() && n != none; ++i)
+                    n = step(n, key[i]);
+                return n;
+            }
+
+            //The id of a keyword, or none
+            uint32_t find(std::string_view key) const {
+                uint32_t n = descend(key);
+                return n != none ? nodes[n].id : none;
+            }
+
+            //Removes a keyword, along with the nodes only it needed.
+            //Returns its id, or none if it did not exist.
+            uint32_t erase(std::string_view key){
+                //The last node on the path that must stay, and the byte leading away from it
+                uint32_t keep = 0;
+                size_t cut = 0;
+
+                uint32_t n = 0;
+                for(size_t i = 0; i < key.length(); ++i){
+                    const node& cur = nodes[n];
+                    if(cur.id != none || (cur.child != none && nodes[cur.child].sibling != none)){
+                        keep = n;
+                        cut = i;
+                    }
+
+                    n = step(n, key[i]);
+                    if(n == none)
+                        return none;
+                }
+
+                uint32_t id = nodes[n].id;
+                if(id == none)
+                    return none;
+
+                nodes[n].id = none;
+                --count;
+
+                if(key.empty() || nodes[n].child != none)
+                    return id;
+
+                //Unlink the branch below keep, which leads only to the erased keyword
+                unsigned char byte = key[cut];
+                uint32_t prev = none;
+                uint32_t k = nodes[keep].child;
+                while(nodes[k].byte != byte){
+                    prev = k;
+                    k = nodes[k].sibling;
+                }
+                if(prev == none)
+                    nodes[keep].child = nodes[k].sibling;
+                else
+                    nodes[prev].sibling = nodes[k].sibling;
+
+                while(k != none){
+                    uint32_t child = nodes[k].child;
+                    nodes[k].sibling = free_nodes;
+                    free_nodes = k;
+                    k = child;
+                }
+
+                return id;
+            }
+
+            //Finds the longest keyword at a position in a single walk.
+            //Returns its id and length, or none and std::string::npos.
+            std::pair<uint32_t, size_t> match(std::string_view str, size_t pos, bool whole_word) const {
+                std::pair<uint32_t, size_t> best(none, std::string::npos);
+
+                if(pos > str.length() || (whole_word && util::word_char(str, pos-1)))
+                    return best;
+
+                uint32_t n = 0;
+                for(size_t i = pos; ; ++i){
+                    if(nodes[n].id != none && !(whole_word && util::word_char(str, i)))
+                        best = {nodes[n].id, i - pos};
+
+                    if(i >= str.length())
+                        break;
+                    n = step(n, str[i]);
+                    if(n == none)
+                        break;
+                }
+
+                return best;
+            }
+
+            //Like find for several keys, setting ids[j] for keys[j]
+            void find_batch(const std::string_view* keys, size_t total, uint32_t* ids) const {
+                walk_batch(total, [&](size_t j){ return keys[j]; }, [&](size_t j, uint32_t n, size_t len){
+                    ids[j] = (len == keys[j].length()) ? nodes[n].id : none;
+                    return true;
+                });
+            }
+
+            //Like match for several positions in strings, setting found[j]
+            //for the position where[j].second in the string where[j].first
+            void match_batch(const std::pair<std::string_view, size_t>* where, size_t total,
+                             bool whole_word, std::pair<uint32_t, size_t>* found) const {
+                walk_batch(total, [&](size_t j){
+                    auto [str, pos] = where[j];
+                    return pos <= str.length() ? str.substr(pos) : std::string_view();
+                }, [&](size_t j, uint32_t n, size_t len){
+                    auto [str, pos] = where[j];
+                    if(len == 0){
+                        found[j] = {none, std::string::npos};
+                        if(pos > str.length() || (whole_word && util::word_char(str, pos-1)))
+                            return false;
+                    }
+                    if(nodes[n].id != none && !(whole_word && util::word_char(str, pos + len)))
+                        found[j] = {nodes[n].id, len};
+                    return true;
+                });
+            }
+
+            //Calls f(key, id) for every keyword, in sorted order, until f returns false
+            template<typename F>
+            void for_each(F f) const {
+                std::string key;
+                visit(0, key, f);
+            }
+
+            //Like for_each, but only for the keywords starting with a prefix,
+            //which are all below the node of the prefix
+            template<typename F>
+            void for_each_prefix(std::string_view prefix, F f) const {
+                uint32_t n = descend(prefix);
+                if(n == none)
+                    return;
+                std::string key(prefix);
+                visit(n, key, f);
+            }
+
+            //Calls f(key, id, edits) for every keyword within max_edits edits
+            //(insertions, deletions or substitutions of bytes) of str, with
+            //its edit distance, in sorted order, until f returns false. The
+            //walk leaves each branch as soon as no keyword below it can be
+            //close enough, like a Levenshtein automaton run along the trie.
+            template<typename F>
+            void for_each_fuzzy(std::string_view str, size_t max_edits, F f) const {
+                const size_t width = str.length() + 1;
+                std::vector< size_t > rows((str.length() + max_edits + 1) * width, max_edits + 1);
+                for(size_t i = 0; i < width && i <= max_edits; ++i)
+                    rows[i] = i;
+
+                std::string key;
+                visit_fuzzy(0, 0, key, str, max_edits, rows, f);
+            }
+
+            //The number of keywords starting with a prefix
+            size_t count_prefix(std::string_view prefix) const {
+                if(prefix.empty())
+                    return count;
+                uint32_t n = descend(prefix);
+                return n != none ? count_below(n) : 0;
+            }
+        };
+
+        //The keywords within max_edits of str, closest first (and then in
+        //sorted order), at most max_results of them. Looks for exact matches
+        //first, then ones with one edit, and so on, as the walks allowing
+        //fewer edits are much shorter.
+        std::vector< fuzzy_match > closest_keywords(const keyword_trie& trie, std::string_view str,
+                                                   size_t max_edits, size_t max_results);
+
+        //A Bloom filter of keywords, which tells that most other strings are
+        //not keywords after reading a single cache line: each keyword sets a
+        //few bits in one block of 512 bits, chosen by its hash. It is sized
+        //for a number of keywords and a rate of false positives, and keywords
+        //can not be removed from it. It also counts the lookups through it.
+        class keyword_bloom {
+        private:
+            static constexpr size_t block_words = 8;
+
+            std::pmr::vector< uint64_t > words;     //with room to align the blocks to cache lines
+            size_t num_blocks;
+            unsigned num_bits;                  //set by each keyword
+            size_t capacity;
+            size_t count;
+            double rate;
+
+            template<typename Words>
+            static auto block(Words& words, size_t num_blocks, uint64_t h){
+                size_t skip = (-reinterpret_cast<uintptr_t>(words.data()) % 64) / sizeof(uint64_t);
+                return words.data() + skip + (h % num_blocks) * block_words;
+            }
+
+        public:
+            mutable std::atomic< uint64_t > hits;
+            mutable std::atomic< uint64_t > misses;
+            mutable std::atomic< uint64_t > false_positives;
+
+            keyword_bloom(size_t capacity, double rate,
+                          std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+            keyword_bloom(const keyword_bloom& other,
+                          std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+            keyword_bloom& operator= (const keyword_bloom&) = delete;
+
+            bool full() const { return count >= capacity; }
+            double false_positive_rate() const { return rate; }
+
+            void add(std::string_view key){
+                uint64_t h = frozen_hash(key);
+                uint64_t* b = block(words, num_blocks, h);
+                uint64_t g = frozen_mix(h, 1);
+                for(unsigned i = 0; i < num_bits; ++i){
+                    unsigned bit = (g + i * ((g >> 32) | 1)) & 511;
+                    b[bit >> 6] |= uint64_t(1) << (bit & 63);
+                }
+                ++count;
+            }
+
+            //False if the key is certainly not a keyword (counting a miss)
+            bool may_contain(std::string_view key) const {
+                uint64_t h = frozen_hash(key);
+                const uint64_t* b = block(words, num_blocks, h);
+                uint64_t g = frozen_mix(h, 1);
+                for(unsigned i = 0; i < num_bits; ++i){
+                    unsigned bit = (g + i * ((g >> 32) | 1)) & 511;
+                    if(!(b[bit >> 6] & (uint64_t(1) << (bit & 63)))){
+                        misses.fetch_add(1, std::memory_order_relaxed);
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            //Counts a lookup that the filter let through
+            void passed(bool found) const {
+                (found ? hits : false_positives).fetch_add(1, std::memory_order_relaxed);
+            }
+        };
+
+        //Finds where keywords of a small set may start, many positions at a
+        //time, by the first few bytes of the keywords (like the "Teddy"
+        //algorithm). The keywords are split into 8 buckets, and each of the
+        //first bytes is looked up to get the buckets that have it there; a
+        //position is a candidate if some bucket has all of its bytes. With
+        //SSSE3, the lookups are done 16 positions at once with byte shuffles
+        //(of the low and the high half of each byte, which may let through
+        //some more candidates); otherwise they are done one by one.
+        class keyword_prefilter {
+        private:
+            size_t width;                       //the number of bytes looked at, or 0 if unusable
+            unsigned char exact[3][256];
+            alignas(16) unsigned char low[3][16];
+            alignas(16) unsigned char high[3][16];
+
+            bool candidate(std::string_view str, size_t pos) const {
+                unsigned char found = exact[0][(unsigned char) str[pos]];
+                for(size_t j = 1; j < width && found; ++j)
+                    found &= exact[j][(unsigned char) str[pos+j]];
+                return found;
+            }
+
+        public:
+            static constexpr size_t max_keywords = 64;
+
+            explicit keyword_prefilter(const keyword_trie& trie);
+
+            bool usable() const { return width > 0; }
+
+            //The first candidate position at or after from, or std::string::npos
+            size_t next(std::string_view str, size_t from) const;
+        };
+
+        //An Aho-Corasick automaton over a keyword_trie, for finding all keywords
+        //in a text in one pass. For each node of the trie, it records the node
+        //of the longest proper suffix of the node's string that is in the trie
+        //(where to continue when the next byte has no child), and of the longest
+        //such suffix that is a keyword. The trie itself is not copied, so it is
+        //passed to each scan, and must not have changed since the automaton was
+        //built; its tables come from the same memory resource as the trie's
+        //nodes. The empty keyword is never reported. For small sets, the
+        //leftmost-longest keywords are instead found by trying the trie at the
+        //candidate positions of a keyword_prefilter.
+        class keyword_automaton {
+        private:
+            std::pmr::vector< uint32_t > fail;
+            std::pmr::vector< uint32_t > dict;
+            std::pmr::vector< uint32_t > depth;
+            keyword_prefilter prefilter;
+
+            uint32_t next(const keyword_trie& trie, uint32_t s, unsigned char byte) const {
+                for(;;){
+                    uint32_t t = trie.step(s, byte);
+                    if(t != keyword_trie::none)
+                        return t;
+                    if(s == 0)
+                        return 0;
+                    s = fail[s];
+                }
+            }
+
+        public:
+            explicit keyword_automaton(const keyword_trie& trie);
+
+            //Calls f(pos, len, id) for the keywords in str, in order of their
+            //ends: all of them, or only the leftmost-longest ones that do not
+            //overlap. Stops when f returns false.
+            template<typename F>
+            void scan(const keyword_trie& trie, std::string_view str, size_t from,
+                      bool whole_word, bool all, F f) const {
+                const uint32_t none = keyword_trie::none;
+
+                if(!all && prefilter.usable()){
+                    for(size_t pos = prefilter.next(str, from); pos != std::string::npos; pos = prefilter.next(str, pos)){
+                        auto [id, len] = trie.match(str, pos, whole_word);
+                        if(id != none && len > 0){
+                            if(!f(pos, len, id))
+                                return;
+                            pos += len;
+                        }
+                        else
+                            ++pos;
+                    }
+                    return;
+                }
+
+                uint32_t best = none;
+                size_t best_pos = 0;
+                size_t best_len = 0;
+
+                uint32_t s = 0;
+                for(size_t i = from; ; ){
+                    if(i >= str.length()){
+                        if(best == none)
+                            return;
+
+                        //Resume after the match, without overlapping it
+                        if(!f(best_pos, best_len, best))
+                            return;
+                        i = best_pos + best_len;
+                        s = 0;
+                        best = none;
+                        continue;
+                    }
+
+                    s = next(trie, s, str[i]);
+                    ++i;
+
+                    for(uint32_t k = (s != 0 && trie.at(s).id != none) ? s : dict[s]; k != none; k = dict[k]){
+                        size_t len = depth[k];
+                        size_t pos = i - len;
+                        if(whole_word && (util::word_char(str, pos-1) || util::word_char(str, i)))
+                            continue;
+
+                        if(all){
+                            if(!f(pos, len, trie.at(k).id))
+                                return;
+                        }
+                        else if(best == none || pos < best_pos || (pos == best_pos && len > best_len)){
+                            best = trie.at(k).id;
+                            best_pos = pos;
+                            best_len = len;
+                        }
+                    }
+
+                    //No keyword starting at or before the best match can still end later
+                    if(best != none && i - depth[s] > best_pos)
+                        i = str.length();
+                }
+            }
+        };
+
+        //Keep file_parser out of the keyword headers
+        std::string_view parser_buffer(const file_parser& parser);
+        size_t parser_column(const file_parser& parser);
+        void parser_move_to(file_parser& parser, size_t col);
+        bool parser_next_line(file_parser& parser);
+
+        //Scans the rest of a parser's input line by line, moving the parser to
+        //the end of each keyword found before calling f(col, len, id)
+        template<typename F>
+        void scan_parser(const keyword_trie& trie, const keyword_automaton& scanner, file_parser& parser,
+                         bool whole_word, bool all, F f){
+            bool go_on = true;
+            size_t from = parser_column(parser);
+            do {
+                scanner.scan(trie, parser_buffer(parser), from, whole_word, all, [&](size_t pos, size_t len, uint32_t id){
+                    parser_move_to(parser, pos + len);
+                    return go_on = f(pos, len, id);
+                });
+                from = 0;
+            } while(go_on && parser_next_line(parser));
+        }
+
+    }
+
+};
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef UTIL_LEXER_H
+#define UTIL_LEXER_H
+
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "keyword_map.hpp"
+#include "regex.hpp"
+
+namespace util {
+
+    /** @brief A token rule: a pattern, and the token id reported for its matches. */
+    struct lexer_rule {
+        std::string pattern;
+        int32_t token;
+    };
+
+    /** @brief A token found by a lexer. */
+    struct lexer_token {
+        int32_t id;
+        size_t offset;
+        size_t length;
+    };
+
+    /**
+     * @brief The tables of a lexer, which may point to constant data, such as
+     * the source emitted by @c lexer::emit_source.
+     *
+     * Bytes are first mapped to classes of bytes that no rule tells apart;
+     * @c num_classes - 1 is the class of the end of the input. The transitions
+     * and accepted tokens are then indexed by state * @c num_classes + class,
+     * and state 0 is dead.
+     */
+    struct lexer_tables {
+        const uint16_t* classes;    //257 entries: the bytes, then the end of the input
+        const uint32_t* next;
+        const int32_t* accept;      //the token ending right before the byte, or -1
+        uint32_t num_classes;
+        uint32_t start[4];          //by (at the beginning of the input) | (after a word character) << 1
+    };
+
+    /**
+     * @brief Finds the longest token at a specified position, using the tables
+     * of a lexer.
+     *
+     * The whole token is found in a single pass with one table lookup per byte.
+     * Of several rules matching the longest token, the first one wins.
+     *
+     * @param tables the lexer's tables.
+     * @param str the string containing the token.
+     * @param pos the position where the token must start.
+     * @param tok set to the token, if there is one.
+     *
+     * @return @c true if a (non-empty) token was found, @c false otherwise.
+     */
+    inline bool lex(const lexer_tables& tables, std::string_view str, size_t pos, lexer_token& tok){
+        const uint32_t n = tables.num_classes;
+
+        bool word = pos > 0 && (std::isalnum((unsigned char) str[pos-1]) || str[pos-1] == '_');
+        uint32_t s = tables.start[(pos == 0) | (word << 1)];
+
+        int32_t id = -1;
+        size_t end = pos;
+        size_t i = pos;
+        for(; i < str.length() && s; ++i){
+            size_t t = size_t(s) * n + tables.classes[(unsigned char) str[i]];
+            if(tables.accept[t] >= 0 && i > pos){
+                id = tables.accept[t];
+                end = i;
+            }
+            s = tables.next[t];
+        }
+        if(s && i == str.length() && i > pos){
+            int32_t at_end = tables.accept[size_t(s) * n + n - 1];
+            if(at_end >= 0){
+                id = at_end;
+                end = i;
+            }
+        }
+
+        if(id < 0)
+            return false;
+
+        tok = {id, pos, end - pos};
+        return true;
+    }
+
+    /**
+     * @brief A lexer generated from an ordered list of token rules and a map
+     * of reserved words.
+     *
+     * All rules and reserved words are combined into a single deterministic
+     * automaton, which is built completely up front and stored in table form.
+     * Tokenizing then takes one pass over the input, without any backtracking,
+     * finding the longest token at each position (maximal munch). If several
+     * rules match the longest token, reserved words win over rules, and earlier
+     * rules over later ones; so an identifier rule can simply come last.
+     *
+     * The tables can also be emitted as C++ source, to be compiled into a
+     * program as constant data and used with @c lex without generating
+     * anything at run time.
+     *
+     * Rules may not use backreferences, lookaround, atomic groups or possessive
+     * quantifiers. Such rules, and rule sets that would need too many states,
+     * are reported like regex syntax errors.
+     */
+    class lexer {
+    private:
+        std::vector< uint16_t > classes;
+        std::vector< uint32_t > next;
+        std::vector< int32_t > accept;
+        lexer_tables tabs;
+
+    public:
+        static constexpr size_t default_max_states = 1 << 16;
+
+        /**
+         * @brief Generates a lexer.
+         *
+         * @param rules the token rules, in order of priority.
+         * @param keywords reserved words and their token ids.
+         * @param flags flags for compiling the rules, as for @c regex
+         *      (@c regex::icase applies to the reserved words too).
+         * @param max_states the maximum number of states of the automaton.
+         */
+        lexer(const std::vector< lexer_rule >& rules, const keyword_map<int32_t>& keywords = {},
+              size_t flags = 0, size_t max_states = default_max_states);
+
+        lexer(const lexer&) = delete;
+        lexer(lexer&&) = default;
+
+        lexer& operator= (const lexer&) = delete;
+        lexer& operator= (lexer&&) = default;
+
+        /** @brief Finds the longest token at a specified position; see @c util::lex. */
+        bool next_token(std::string_view str, size_t pos, lexer_token& tok) const {
+            return lex(tabs, str, pos, tok);
+        }
+
+        /** @brief Tokenizes a whole string, skipping bytes that do not start any token. */
+        std::vector< lexer_token > tokenize(std::string_view str) const;
+
+        const lexer_tables& tables() const { return tabs; }
+        size_t state_count() const { return next.size() / tabs.num_classes; }
+
+        /**
+         * @brief Emits the tables as C++ source, defining a constant
+         * @c util::lexer_tables called @p name along with its arrays.
+         */
+        std::string emit_source(const std::string& name) const;
+    };
+
+};
+
+#endif
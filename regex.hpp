@@ -1,111 +1,803 @@
 #ifndef UTIL_REGEX_H
 #define UTIL_REGEX_H
 
+#ifndef UTIL_REGEX_ERROR_THROW
+#    define UTIL_REGEX_ERROR_THROW 0
+#endif
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
 #include <string>
-#include <list>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#if UTIL_REGEX_ERROR_THROW
+#include <stdexcept>
 
 namespace util {
-    
+    class regex_error : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+};
+
+#endif
+
+namespace util {
+
     class file_parser;
+    class regex_profile;
+
+    namespace detail {
+
+        class regex_parser;
+
+        //A single instruction of a compiled pattern. Consuming instructions
+        //(CHAR, CLASS, BACKREF) read forwards from the current position,
+        //or backwards from it if the backwards flag is set.
+        struct regex_inst {
+            enum opcode : uint8_t {
+                CHAR,       //match the byte x
+                CLASS,      //match any byte in character class x
+                RUN,        //match as many bytes in character class x as possible, never giving any back
+                            //(y: made possessive by the compiler, not the user)
+                SPLIT,      //try x first, then y
+                JUMP,       //continue at x
+                SAVE,       //store the position in slot x
+                MARK,       //store the position in loop slot x
+                CHECK,      //fail if the position equals loop slot x (empty iteration)
+                ASSERT,     //zero-width assertion of kind x
+                BACKREF,    //match the text captured by group x (y: ignoring case)
+                ATOMIC,     //atomic sub-pattern, ends with END_SUB
+                LOOK,       //lookaround sub-pattern (x: negated), ends with END_SUB at y-1
+                END_SUB,    //end of the innermost ATOMIC or LOOK
+                MATCH       //the pattern has matched
+            } op;
+            bool backwards;
+            uint32_t x;
+            uint32_t y;
+        };
+
+        //A compiled pattern, in a form suitable for a backtracking matcher.
+        struct regex_program {
+            std::vector< regex_inst > code;
+            std::vector< std::bitset<256> > classes;
+
+            //For each instruction, the part of the pattern it was compiled from
+            std::vector< std::pair<size_t, size_t> > origin;
+
+            size_t num_groups;  //number of capturing groups, including the implicit group 0
+            size_t num_slots;   //two per group, plus one per nullable loop
+
+            //Bytes that can start a match, and whether the empty string matches;
+            //used to skip hopeless starting positions when searching
+            std::bitset<256> first;
+            bool nullable;
+            bool anchored;
+
+            //Whether there are backreferences, which a backwards program would
+            //read before the groups they refer to
+            bool backrefs;
+        };
+
+        //What can start a match of a node: its first bytes, whether it can be
+        //empty, and whether it starts with something other than plain bytes
+        //(an assertion, backreference or lookaround) that defies analysis.
+        struct regex_first {
+            std::bitset<256> chars;
+            bool nullable;
+            bool opaque;
+        };
+    }
+
+    /**
+     * @brief The workspace of the backtracking matcher.
+     *
+     * All state needed by a single match (the backtracking stack and the capture
+     * slots) lives in one contiguous buffer that is reset, but not freed, between
+     * matches. Once it has grown to fit the patterns and inputs it is used with,
+     * matching does not allocate at all.
+     *
+     * A budget limits the number of steps and the amount of memory a single match
+     * may use. If it is exceeded, the match fails immediately and
+     * @c budget_exceeded() returns @c true until the next match.
+     *
+     * A stack may be shared between different patterns, but not between threads.
+     */
+    class regex_stack {
+    private:
+        friend class regex;
+
+        struct frame {
+            enum : uint32_t {
+                CHOICE,     //alternative to try: pc = a, position = b
+                RESTORE,    //slot a had the value b
+                BARRIER     //opened by instruction a at position b; c is the previous barrier
+            } kind;
+            uint32_t a;
+            size_t b;
+            size_t c;
+        };
 
+        std::vector< frame > frames;
+        std::vector< size_t > slots;
+        size_t top_barrier;
+
+        size_t max_steps;
+        size_t max_bytes;
+        size_t steps;
+        bool exceeded;
+
+        regex_profile* profile;
+
+        void reset(size_t num_slots);
+        bool push(const frame& f);
+
+    public:
+        static const size_t unlimited = std::numeric_limits<size_t>::max();
+
+        /**
+         * @brief Creates an empty stack.
+         *
+         * @param max_steps the maximum number of instructions a single match
+         *      (or search) may execute.
+         * @param max_bytes the maximum size of the backtracking stack.
+         */
+        regex_stack(size_t max_steps = unlimited, size_t max_bytes = unlimited)
+         : frames(), slots(), top_barrier(0),
+           max_steps(max_steps), max_bytes(max_bytes), steps(0), exceeded(false),
+           profile(nullptr) {}
+
+        /** @brief Changes the budget of subsequent matches. */
+        void set_budget(size_t max_steps, size_t max_bytes = unlimited){
+            this->max_steps = max_steps;
+            this->max_bytes = max_bytes;
+        }
+
+        /** @brief Whether the most recent match was aborted due to the budget. */
+        bool budget_exceeded() const { return exceeded; }
+
+        /** @brief Number of instructions executed by the most recent match. */
+        size_t step_count() const { return steps; }
+
+        /**
+         * @brief Records the work of subsequent matches of the profile's pattern
+         * in a profile, or stops recording if @p profile is null.
+         */
+        void set_profile(regex_profile* profile){ this->profile = profile; }
+    };
+
+    /**
+     * @brief A node in the syntax tree of a pattern.
+     *
+     * Every node may be repeated, capture a group, and act as an atomic group or
+     * a lookaround. Quantifiers are outermost, so a node means
+     * @code repeat{min_rep, max_rep}( lookaround-or-atomic( group( single ) ) ) @endcode
+     * and anything else is expressed by nesting the node in a sequence.
+     */
     class regex_impl {
     protected:
+        friend class detail::regex_parser;
+
         size_t min_rep; //minimum allowed repetitions
         size_t max_rep; //maximum allowed repetitions
-        
+
         size_t group;   //capturing group index (zero for none)
-                
-        enum {
-            SINGLE             = 0b0 00 00 000 000001,
-            ZERO_OR_ONE        = 0b0 00 00 000 000010,
-            ZERO_OR_MORE       = 0b0 00 00 000 000100,
-            ONE_OR_MORE        = 0b0 00 00 000 001000,
-            MIN_UPTO_MAX       = 0b0 00 00 000 010011,
-            MIN_OR_MORE        = 0b0 00 00 000 101100,  
-            NUMBER_MODIFIER    = 0b0 00 00 000 111111,
-            
-            GREEDY             = 0b0 00 00 001 000000, 
-            RELUCTANT          = 0b0 00 00 010 000000,
-            POSSESSIVE         = 0b0 00 00 100 000000,
-            BACKTRACK_MODIFIER = 0b0 00 00 111 000000,
-            
-            FORWARDS           = 0b0 00 01 000 000000,
-            BACKWARDS          = 0b0 00 10 000 000000,
-            DIRECTION_MODIFIER = 0b0 00 11 000 000000,
-            
-            LOOKAHEAD          = 0b0 01 00 000 000000,
-            NEG_LOOKAHEAD      = 0b0 10 00 000 000000,
-            LOOKAHEAD_MODIFIER = 0b0 11 00 000 000000,
-            
-            ATOMIC             = 0b1 00 00 000 000000
-        } modifier;            
-        
-        struct attempt {
-            size_t len;
-            size_t rep;
-                        
-            ~attempt();
+
+        enum modifier_flags {
+            SINGLE             = 0b0'00'00'000'000001,
+            ZERO_OR_ONE        = 0b0'00'00'000'000010,
+            ZERO_OR_MORE       = 0b0'00'00'000'000100,
+            ONE_OR_MORE        = 0b0'00'00'000'001000,
+            MIN_UPTO_MAX       = 0b0'00'00'000'010011,
+            MIN_OR_MORE        = 0b0'00'00'000'101100,
+            NUMBER_MODIFIER    = 0b0'00'00'000'111111,
+
+            GREEDY             = 0b0'00'00'001'000000,
+            RELUCTANT          = 0b0'00'00'010'000000,
+            POSSESSIVE         = 0b0'00'00'100'000000,
+            BACKTRACK_MODIFIER = 0b0'00'00'111'000000,
+
+            FORWARDS           = 0b0'00'01'000'000000,
+            BACKWARDS          = 0b0'00'10'000'000000,
+            DIRECTION_MODIFIER = 0b0'00'11'000'000000,
+
+            LOOKAHEAD          = 0b0'01'00'000'000000,
+            NEG_LOOKAHEAD      = 0b0'10'00'000'000000,
+            LOOKAHEAD_MODIFIER = 0b0'11'00'000'000000,
+
+            ATOMIC             = 0b1'00'00'000'000000
         };
-        std::stack< std::unique_ptr<attempt> > attempts
-                
-        void pop_attempt();
-        void pop_repeated_attempt();
-                
-        virtual bool change_match(file_parser& parser, size_t& len);
-        virtual bool match_single(file_parser& parser, size_t rep, size_t& len) = 0;
-        
+        unsigned modifier;
+
+        size_t source;      //position in the pattern right after the quantifier
+        bool possessified;  //made possessive by the compiler, not the user
+
+        size_t begin;       //the part of the pattern the node was parsed from
+        size_t end;
+
+        void compile_repeated(detail::regex_program& prog, bool backwards) const;
+        void compile_once(detail::regex_program& prog, bool backwards) const;
+        virtual void compile_single(detail::regex_program& prog, bool backwards) const = 0;
+
+        virtual void first_single(detail::regex_first& first) const = 0;
+        virtual void possessify_single(const detail::regex_first& /*follow*/, std::vector<size_t>& /*converted*/) {}
+        //Whether a single repetition can only match in one way
+        virtual bool fixed_single() const { return false; }
+        //Whether a single repetition matches exactly one byte, and if so, which ones
+        virtual bool single_byte(std::bitset<256>& /*chars*/) const { return false; }
+
     public:
-        bool match(file_parser& parser, size_t& len);
+        static const size_t unbounded = std::numeric_limits<size_t>::max();
+
+        regex_impl()
+         : min_rep(1), max_rep(1), group(0), modifier(SINGLE | GREEDY | FORWARDS),
+           source(std::string::npos), possessified(false), begin(0), end(0) {}
+        virtual ~regex_impl() = default;
+
+        /** @brief Whether the node can match the empty string. */
+        bool nullable() const;
+        virtual bool nullable_single() const = 0;
+
+        /** @brief What can start a match of this node. */
+        detail::regex_first first() const;
+
+        /**
+         * @brief Makes greedy quantifiers possessive where that can not change
+         * the result, because nothing that follows them could ever be matched
+         * by giving back a repetition.
+         *
+         * @param follow what can follow this node.
+         * @param converted receives the pattern positions of the converted quantifiers.
+         */
+        void possessify(const detail::regex_first& follow, std::vector<size_t>& converted);
+
+        /** @brief Appends the instructions matching this node to a program. */
+        void compile(detail::regex_program& prog, bool backwards = false) const;
     };
-    
+
     class literal : public regex_impl {
     private:
-        std::string literal;
-        
-        virtual bool match_single(file_parser& parser, size_t rep, size_t& len);
-    }
-    
+        std::string str;
+
+        virtual void compile_single(detail::regex_program& prog, bool backwards) const;
+
+    public:
+        literal(const std::string& str) : regex_impl(), str(str) {}
+
+        virtual bool nullable_single() const { return str.empty(); }
+        virtual void first_single(detail::regex_first& first) const;
+        virtual bool fixed_single() const { return !str.empty(); }
+        virtual bool single_byte(std::bitset<256>& chars) const;
+
+        friend class detail::regex_parser;
+    };
+
     class char_class : public regex_impl {
     private:
-        std::string chars;
-        bool negated;
-        
-        virtual bool match_single(file_parser& parser, size_t rep, size_t& len);
+        std::bitset<256> chars;
+
+        virtual void compile_single(detail::regex_program& prog, bool backwards) const;
+
+    public:
+        char_class(const std::bitset<256>& chars) : regex_impl(), chars(chars) {}
+
+        virtual bool nullable_single() const { return false; }
+        virtual void first_single(detail::regex_first& first) const;
+        virtual bool fixed_single() const { return true; }
+        virtual bool single_byte(std::bitset<256>& chars) const { chars = this->chars; return true; }
     };
-    
+
     class assertion : public regex_impl {
+    public:
+        enum kind {
+            BEGIN, END, BOUNDARY, NOT_BOUNDARY
+        };
+
     private:
-        enum {
-            BEGIN, END, LINE BOUNDARY, NOT_BOUNDARY
-        } type;
-        
-        virtual bool match_single(file_parser& parser, size_t rep, size_t& len);
+        kind type;
+
+        virtual void compile_single(detail::regex_program& prog, bool backwards) const;
+
+    public:
+        assertion(kind type) : regex_impl(), type(type) {}
+
+        virtual bool nullable_single() const { return true; }
+        virtual void first_single(detail::regex_first& first) const;
+    };
+
+    class backreference : public regex_impl {
+    private:
+        size_t ref;     //index of the referenced group
+        bool icase;     //whether the case of the referenced text matters
+
+        virtual void compile_single(detail::regex_program& prog, bool backwards) const;
+
+    public:
+        backreference(size_t ref, bool icase = false) : regex_impl(), ref(ref), icase(icase) {}
+
+        //The group may well have captured the empty string
+        virtual bool nullable_single() const { return true; }
+        virtual void first_single(detail::regex_first& first) const;
     };
-        
+
     class alternative : public regex_impl {
-    private: 
+    private:
         //First option
         std::unique_ptr< regex_impl > head;
         //Second option, which may itself be an alternative
         std::unique_ptr< regex_impl > tail;
-        
-        virtual bool match_single(file_parser& parser, size_t rep, size_t& len);
-        
-        struct alt_attempt : public attempt {
-            bool tail_attempted;
-        };
+
+        virtual void compile_single(detail::regex_program& prog, bool backwards) const;
+
+    public:
+        alternative(std::unique_ptr< regex_impl >&& head, std::unique_ptr< regex_impl >&& tail)
+         : regex_impl(), head(std::move(head)), tail(std::move(tail)) {}
+
+        virtual bool nullable_single() const { return head->nullable() || tail->nullable(); }
+        virtual void first_single(detail::regex_first& first) const;
+        virtual void possessify_single(const detail::regex_first& follow, std::vector<size_t>& converted);
     };
-    
+
     class sequence : public regex_impl {
     private:
-        //First option
+        //First element
         std::unique_ptr< regex_impl > head;
-        //Second option, which may itself be a sequence
+        //Remaining elements, which may themselves be a sequence (or null)
         std::unique_ptr< regex_impl > tail;
-        
-        virtual bool match_single(file_parser& parser, size_t rep, size_t& len);
+
+        virtual void compile_single(detail::regex_program& prog, bool backwards) const;
+
+    public:
+        sequence(std::unique_ptr< regex_impl >&& head, std::unique_ptr< regex_impl >&& tail = nullptr)
+         : regex_impl(), head(std::move(head)), tail(std::move(tail)) {}
+
+        virtual bool nullable_single() const { return head->nullable() && (!tail || tail->nullable()); }
+        virtual void first_single(detail::regex_first& first) const;
+        virtual void possessify_single(const detail::regex_first& follow, std::vector<size_t>& converted);
+    };
+
+    /** @brief The location of a captured group; the offset is @c npos if it did not participate. */
+    struct regex_span {
+        size_t offset;
+        size_t length;
+    };
+
+    /**
+     * @brief The result of a match: the spans of all capturing groups.
+     *
+     * Group 0 is the whole match. The spans are stored in a fixed-size array
+     * of @p N elements, or, if @p N is zero, in a vector sized from the pattern
+     * the first time it is used. Groups that do not fit are not recorded.
+     * Either way, a result that is reused for many matches does not allocate.
+     *
+     * The captured strings are views into the matched string (or the line
+     * buffer of the matched @c file_parser), and are only valid as long as it is.
+     *
+     * @tparam N the maximum number of groups to record, or zero for all of them.
+     */
+    template<size_t N = 0>
+    class regex_match {
+    private:
+        friend class regex;
+
+        std::string_view subject;
+        std::conditional_t< N == 0, std::vector<regex_span>, std::array<regex_span, N> > spans;
+        size_t count;
+
+        //Makes room for the groups of a pattern, and returns how many will be recorded
+        size_t prepare(std::string_view str, size_t groups){
+            subject = str;
+            if constexpr (N == 0){
+                if(spans.size() < groups)
+                    spans.resize(groups);
+            }
+            count = std::min(groups, spans.size());
+            return count;
+        }
+
+    public:
+        regex_match() : subject(), spans(), count(0) {}
+
+        /** @brief Number of recorded groups (zero if nothing has matched). */
+        size_t size() const { return count; }
+
+        /** @brief Whether a group participated in the match. */
+        bool matched(size_t group = 0) const {
+            return group < count && spans[group].offset != std::string_view::npos;
+        }
+
+        size_t position(size_t group = 0) const { return spans[group].offset; }
+        size_t length(size_t group = 0) const { return spans[group].length; }
+        const regex_span& span(size_t group = 0) const { return spans[group]; }
+
+        /** @brief The text captured by a group, or an empty view if it did not participate. */
+        std::string_view str(size_t group = 0) const {
+            return matched(group) ? subject.substr(spans[group].offset, spans[group].length) : std::string_view();
+        }
+        std::string_view operator[] (size_t group) const { return str(group); }
+    };
+
+    template<size_t N>
+    class regex_matches;
+
+    /**
+     * @brief A compiled regular expression.
+     *
+     * The syntax is the usual Perl-like one: alternatives @c | , groups
+     * @c (...) , @c (?:...) , atomic groups @c (?>...) , lookaround
+     * @c (?=...) , @c (?!...) , @c (?<=...) , @c (?<!...) , quantifiers
+     * @c * , @c + , @c ? and @c {m,n} (optionally followed by @c ? for reluctant
+     * or @c + for possessive), character classes @c [...] , @c . , @c \\d ,
+     * @c \\w , @c \\s (and their negations), anchors @c ^ , @c $ , @c \\b , @c \\B
+     * and backreferences @c \\1 to @c \\9 .
+     *
+     * Matching is done by backtracking over a compiled program, using a
+     * @c regex_stack as workspace. The overloads that do not take a stack use
+     * one owned by the regex, so a single regex object must not be used for
+     * matching by several threads at once without providing separate stacks.
+     *
+     * When matching against a @c file_parser, the pattern is matched against the
+     * parser's current line, so matches can not span several lines.
+     *
+     * Every pattern is also compiled backwards, into a program that reads a
+     * match from its end to its beginning. It is used for matches that must
+     * end at a given position (@c match_before, and @c file_parser::backwards),
+     * and by @c regex_dfa to find where matches start. Atomic groups and
+     * possessive quantifiers act in the direction of reading, so backwards they
+     * may allow matches that would fail forwards. Backwards, a backreference
+     * would be read before its group, so patterns with backreferences are
+     * instead matched forwards from each earlier position in turn, keeping
+     * the longest match that ends at the given position; this takes time
+     * proportional to that position.
+     */
+    class regex {
+    private:
+        template<size_t N>
+        friend class regex_matches;
+
+        std::string pattern;
+        std::unique_ptr< regex_impl > root;
+        detail::regex_program prog;
+        detail::regex_program rprog;    //the same pattern, compiled backwards
+        std::vector< size_t > converted;
+
+        mutable regex_stack default_stack;
+
+        //Keep file_parser out of this header
+        static std::string_view parser_buffer(const file_parser& parser);
+        static size_t parser_column(const file_parser& parser);
+        static void consume(file_parser& parser, size_t len, size_t opts);
+        static void move_to(file_parser& parser, size_t col);
+        static bool next_line(file_parser& parser);
+
+        //With until other than npos, only matches ending there are accepted
+        bool run(const detail::regex_program& prog, std::string_view str, size_t start,
+                 regex_stack& stack, size_t& end, size_t until = std::string::npos) const;
+        template<bool profiling>
+        bool execute(const detail::regex_program& prog, std::string_view str, size_t start,
+                     regex_stack& stack, size_t& end, size_t until) const;
+        bool match_parser(const file_parser& parser, size_t& len, size_t opts, regex_stack& stack) const;
+        void get_spans(const regex_stack& stack, regex_span* spans, size_t count) const;
+
+        template<size_t N>
+        bool fill(bool found, std::string_view str, regex_match<N>& result, const regex_stack& stack) const {
+            if(!found){
+                result.count = 0;
+                return false;
+            }
+            get_spans(stack, result.spans.data(), result.prepare(str, prog.num_groups));
+            return true;
+        }
+
+    public:
+        /**
+         * @brief Compiles a pattern.
+         *
+         * Syntax errors are reported like those of @c file_parser: by printing
+         * a message and exiting, or by throwing a @c regex_error if
+         * @c UTIL_REGEX_ERROR_THROW is set.
+         *
+         * Unless @c no_possessify is given, greedy quantifiers that could never
+         * usefully give back a repetition (like the one in @c [a-z]+: ) are
+         * made possessive, which spares the matcher from trying.
+         *
+         * With @c icase, letters match regardless of their (ASCII) case. Literals
+         * and character classes are folded when compiling, so matching costs
+         * the same as with case, and the input is never converted.
+         *
+         * @param pattern the pattern.
+         * @param flags any combination of the flags below.
+         */
+        regex(const std::string& pattern, size_t flags = 0);
+
+        static const size_t no_possessify = 0b0001;
+        static const size_t icase         = 0b0010;
+
+        regex(const regex&) = delete;
+        regex(regex&&) = default;
+
+        regex& operator= (const regex&) = delete;
+        regex& operator= (regex&&) = default;
+
+        /**
+         * @brief Matches the pattern at a specified position.
+         *
+         * @param str the string containing the potential match.
+         * @param pos the position where the match must start.
+         * @param len set to the length of the match, if there is one.
+         * @param stack the workspace to use.
+         *
+         * @return @c true if the pattern matched, @c false otherwise
+         *      (including if the budget of @p stack was exceeded).
+         */
+        bool match(std::string_view str, size_t pos, size_t& len, regex_stack& stack) const;
+        bool match(std::string_view str, size_t pos, size_t& len) const {
+            return match(str, pos, len, default_stack);
+        }
+
+        /**
+         * @brief Matches the pattern backwards, so that it ends at a specified position.
+         *
+         * @param pos the position where the match must end.
+         * @param len set to the length of the match, which starts at @p pos - @p len.
+         *
+         * The other parameters and the return value are as for @c match.
+         */
+        bool match_before(std::string_view str, size_t pos, size_t& len, regex_stack& stack) const;
+        bool match_before(std::string_view str, size_t pos, size_t& len) const {
+            return match_before(str, pos, len, default_stack);
+        }
+
+        /**
+         * @brief Finds the leftmost match at or after a specified position.
+         *
+         * @param begin set to the position of the match, if there is one.
+         *
+         * The other parameters and the return value are as for @c match.
+         */
+        bool search(std::string_view str, size_t pos, size_t& begin, size_t& len, regex_stack& stack) const;
+        bool search(std::string_view str, size_t pos, size_t& begin, size_t& len) const {
+            return search(str, pos, begin, len, default_stack);
+        }
+
+        /**
+         * @brief Matches the pattern at the current position of a parser.
+         *
+         * @param parser the parser.
+         * @param len set to the length of the match, if there is one.
+         * @param opts like the options of @c file_parser::match;
+         *      if @c file_parser::backwards is set, the match must end at the
+         *      current position (like @c match_before), and if
+         *      @c file_parser::consume is set, the parser is moved past the match.
+         */
+        bool match(file_parser& parser, size_t& len, size_t opts = 0) const;
+
+        /**
+         * @brief Like the corresponding overloads above, but also records the
+         * spans of all capturing groups in @p result.
+         */
+        template<size_t N>
+        bool match(std::string_view str, size_t pos, regex_match<N>& result, regex_stack& stack) const {
+            size_t len;
+            return fill(match(str, pos, len, stack), str, result, stack);
+        }
+        template<size_t N>
+        bool match(std::string_view str, size_t pos, regex_match<N>& result) const {
+            return match(str, pos, result, default_stack);
+        }
+        template<size_t N>
+        bool match_before(std::string_view str, size_t pos, regex_match<N>& result, regex_stack& stack) const {
+            size_t len;
+            return fill(match_before(str, pos, len, stack), str, result, stack);
+        }
+        template<size_t N>
+        bool match_before(std::string_view str, size_t pos, regex_match<N>& result) const {
+            return match_before(str, pos, result, default_stack);
+        }
+        template<size_t N>
+        bool search(std::string_view str, size_t pos, regex_match<N>& result, regex_stack& stack) const {
+            size_t begin, len;
+            return fill(search(str, pos, begin, len, stack), str, result, stack);
+        }
+        template<size_t N>
+        bool search(std::string_view str, size_t pos, regex_match<N>& result) const {
+            return search(str, pos, result, default_stack);
+        }
+        template<size_t N>
+        bool match(file_parser& parser, regex_match<N>& result, size_t opts = 0) const {
+            size_t len;
+            if(!fill(match_parser(parser, len, opts, default_stack), parser_buffer(parser), result, default_stack))
+                return false;
+            consume(parser, len, opts);
+            return true;
+        }
+
+        /**
+         * @brief Lazily finds all non-overlapping matches, for use in a range-based for loop.
+         *
+         * @param str the string to search.
+         * @param pos the position to start at.
+         * @param stack the workspace to use.
+         */
+        template<size_t N = 0>
+        regex_matches<N> find_all(std::string_view str, size_t pos, regex_stack& stack) const;
+        template<size_t N = 0>
+        regex_matches<N> find_all(std::string_view str, size_t pos = 0) const;
+
+        /**
+         * @brief Lazily finds all non-overlapping matches in the rest of a parser's
+         * input, line by line, moving the parser to the end of each match in turn.
+         */
+        template<size_t N = 0>
+        regex_matches<N> find_all(file_parser& parser) const;
+
+        /** @brief The workspace used by the overloads that do not take one. */
+        regex_stack& get_stack() const { return default_stack; }
+
+        const std::string& get_pattern() const { return pattern; }
+        const detail::regex_program& get_program() const { return prog; }
+        const detail::regex_program& get_reverse_program() const { return rprog; }
+
+        /**
+         * @brief The quantifiers made possessive by the compiler, as positions
+         * in the pattern right after each of them.
+         */
+        const std::vector<size_t>& possessified() const { return converted; }
+
+        /** @brief The pattern, with the quantifiers made possessive by the compiler marked as such. */
+        std::string possessified_pattern() const;
+
+        /** @brief Number of capturing groups, including the implicit group 0. */
+        size_t groups() const { return prog.num_groups; }
+    };
+
+    /**
+     * @brief The non-overlapping matches of a pattern in a string or parser,
+     * found one at a time as they are iterated over.
+     *
+     * Each search resumes where the previous match ended, reusing the same
+     * workspace and result, so iterating does not allocate. The result of the
+     * current match is only valid until the iterator is advanced, and its
+     * captures are views into the searched string (or the parser's current line).
+     *
+     * Like any input range, it can only be iterated over once.
+     *
+     * @tparam N the maximum number of groups to record, as for @c regex_match.
+     */
+    template<size_t N = 0>
+    class regex_matches {
+    private:
+        const regex& re;
+        regex_stack& stack;
+        std::string_view str;
+        file_parser* parser;
+        size_t pos;
+
+        regex_match<N> result;
+        bool started;
+        bool done;
+
+        //Finds the next match, going on to the next line of the parser if
+        //need be, and moves past it; an empty match moves on by one more
+        bool find(size_t& begin, size_t& len, bool captures){
+            for(;;){
+                if(parser)
+                    str = regex::parser_buffer(*parser);
+
+                bool found = false;
+                if(pos <= str.length()){
+                    if(captures && re.search(str, pos, result, stack)){
+                        begin = result.position();
+                        len = result.length();
+                        found = true;
+                    }
+                    else if(!captures)
+                        found = re.search(str, pos, begin, len, stack);
+                }
+
+                if(found){
+                    pos = begin + std::max<size_t>(len, 1);
+                    if(parser)
+                        regex::move_to(*parser, begin + len);
+                    return true;
+                }
+
+                if(!parser || !regex::next_line(*parser))
+                    return false;
+                pos = 0;
+            }
+        }
+
+        void advance(){
+            size_t begin, len;
+            started = true;
+            done = !find(begin, len, true);
+        }
+
+    public:
+        regex_matches(const regex& re, std::string_view str, size_t pos, regex_stack& stack)
+         : re(re), stack(stack), str(str), parser(nullptr), pos(pos),
+           result(), started(false), done(false) {}
+        regex_matches(const regex& re, file_parser& parser, regex_stack& stack)
+         : re(re), stack(stack), str(), parser(&parser), pos(regex::parser_column(parser)),
+           result(), started(false), done(false) {}
+
+        regex_matches(const regex_matches&) = delete;
+        regex_matches& operator= (const regex_matches&) = delete;
+
+        class iterator {
+        private:
+            regex_matches* range;
+
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type        = regex_match<N>;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = const regex_match<N>*;
+            using reference         = const regex_match<N>&;
+
+            iterator(regex_matches* range = nullptr) : range(range) {}
+
+            reference operator* () const { return range->result; }
+            pointer operator-> () const { return &range->result; }
+
+            iterator& operator++ (){
+                range->advance();
+                return *this;
+            }
+
+            //All iterators of a range are at the same match, so only the end matters
+            bool operator== (const iterator& other) const {
+                return (!range || range->done) == (!other.range || other.range->done);
+            }
+            bool operator!= (const iterator& other) const { return !(*this == other); }
+        };
+
+        iterator begin(){
+            if(!started)
+                advance();
+            return iterator(this);
+        }
+        iterator end(){ return iterator(); }
+
+        /**
+         * @brief Counts the remaining matches, without recording any captures.
+         * This uses up the range.
+         */
+        size_t count(){
+            size_t n = 0;
+            if(started && !done)
+                ++n;
+
+            size_t begin, len;
+            while(!done && find(begin, len, false))
+                ++n;
+
+            started = done = true;
+            return n;
+        }
     };
-    
-}
+
+    template<size_t N>
+    regex_matches<N> regex::find_all(std::string_view str, size_t pos, regex_stack& stack) const {
+        return regex_matches<N>(*this, str, pos, stack);
+    }
+    template<size_t N>
+    regex_matches<N> regex::find_all(std::string_view str, size_t pos) const {
+        return regex_matches<N>(*this, str, pos, default_stack);
+    }
+    template<size_t N>
+    regex_matches<N> regex::find_all(file_parser& parser) const {
+        return regex_matches<N>(*this, parser, default_stack);
+    }
+
+};
 
 #endif
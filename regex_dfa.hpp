@@ -0,0 +1,243 @@
+#ifndef UTIL_REGEX_DFA_H
+#define UTIL_REGEX_DFA_H
+
+#include <bitset>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "regex.hpp"
+#include "file_parser.hpp"
+
+namespace util {
+
+    /**
+     * @brief A lazily built deterministic automaton for a compiled pattern.
+     *
+     * States are sets of program positions, created the first time they are
+     * reached and cached together with their transitions, so that scanning
+     * mostly consists of table lookups. If the cache grows beyond its budget,
+     * it is flushed and rebuilt as needed.
+     *
+     * The automaton only decides where matches end, not which captures they
+     * have. Built from the reverse program of a pattern, it reads the input
+     * backwards and decides where matches start instead; @c regex_searcher
+     * combines both to find matches without any backtracking.
+     *
+     * Patterns using backreferences, lookaround, atomic groups or possessive
+     * quantifiers (other than those introduced by possessification) can not
+     * be handled; check @c supports() first.
+     *
+     * Each thread needs its own automaton, but they may share the regex.
+     */
+    class regex_dfa {
+    private:
+        //With leftmost, the positions are split into groups by mark, in the
+        //order of the positions where their matches started
+        struct state {
+            std::vector<uint32_t> pcs;
+            bool at_begin;
+            bool prev_word;
+            bool matched;   //a match has been seen, so no new ones may start
+        };
+        static constexpr uint32_t mark = std::numeric_limits<uint32_t>::max();
+
+        const detail::regex_program& prog;
+        size_t opts;
+        size_t max_bytes;
+
+        std::vector< state > states;
+        std::vector< int32_t > next_state;  //indexed by state * symbols + symbol; -1 if unknown
+        std::vector< int32_t > match_id;    //likewise; the lowest match id reached, or -1
+        std::unordered_map< std::string, uint32_t > index;
+        size_t bytes;
+        uint32_t start_state;
+
+        //Scratch space for computing transitions
+        std::vector<uint32_t> work;
+        std::vector<uint32_t> found;
+        std::vector<uint32_t> visited;
+        uint32_t generation;
+        std::string key;
+
+        size_t flushes;
+        size_t misses;
+
+        regex_profile* profile;
+
+        uint32_t add_state(const std::vector<uint32_t>& pcs, bool at_begin, bool prev_word, bool matched = false);
+        uint32_t compute(uint32_t s, unsigned symbol, int32_t& match);
+        void closure(size_t begin, size_t end, uint32_t s, unsigned look, int32_t& match);
+        void flush();
+
+    public:
+        static constexpr unsigned symbols = 257;
+        static constexpr unsigned end_symbol = 256;
+        static constexpr uint32_t dead = 0;
+        static constexpr size_t default_budget = 8 << 20;
+
+        /** @brief Let matches start anywhere (for searching), not only at the beginning. */
+        static constexpr size_t unanchored = 0b0001;
+        /** @brief Treat newlines as line separators that no match can span. */
+        static constexpr size_t lines      = 0b0010;
+        /**
+         * @brief Read the input backwards, from the end: the start state is at the
+         *      end of the input, and @c end_symbol stands for its beginning.
+         *      The program must have been compiled backwards.
+         */
+        static constexpr size_t reverse    = 0b0100;
+        /**
+         * @brief Once a match has been seen, only report those that started no
+         *      later than it did, and no new ones. With @c unanchored, the last
+         *      match reported is then where the leftmost-longest match ends.
+         */
+        static constexpr size_t leftmost   = 0b1000;
+
+        /**
+         * @brief Creates an automaton.
+         *
+         * @param prog the compiled pattern.
+         * @param opts any combination of the options above.
+         * @param max_bytes the maximum size of the state cache.
+         */
+        regex_dfa(const detail::regex_program& prog, size_t opts = unanchored | lines, size_t max_bytes = default_budget);
+        regex_dfa(const regex& re, size_t opts = unanchored | lines, size_t max_bytes = default_budget)
+         : regex_dfa((opts & reverse) ? re.get_reverse_program() : re.get_program(), opts, max_bytes) {}
+
+        /** @brief Whether a pattern can be handled by an automaton. */
+        static bool supports(const detail::regex_program& prog);
+        static bool supports(const regex& re) { return supports(re.get_program()); }
+
+        /** @brief The state at the beginning of the input (or of a line). */
+        uint32_t start() const { return start_state; }
+
+        /**
+         * @brief The state for starting in the middle of the input.
+         *
+         * @param at_begin whether this is the beginning of the input after all.
+         * @param prev_word whether the byte before the position (or after it,
+         *      with @c reverse) is a word character.
+         *
+         * @return the state, which, like the result of @c next, may have flushed the cache.
+         */
+        uint32_t start(bool at_begin, bool prev_word){
+            if(at_begin && !prev_word)
+                return start_state;
+            return add_state({0}, at_begin, prev_word);
+        }
+
+        /**
+         * @brief Advances the automaton by one symbol.
+         *
+         * @param s the current state.
+         * @param symbol the next byte, or @c end_symbol at the end of the input.
+         * @param match set to the lowest id of a match ending before @p symbol
+         *      (the ids of plain patterns are zero), or -1 if there is none.
+         *
+         * @return the next state, which is @c dead if no match is possible any more.
+         *      Computing a transition may flush the cache, so only the most
+         *      recently returned state (and the start state) may be used.
+         */
+        uint32_t next(uint32_t s, unsigned symbol, int32_t& match){
+            size_t t = size_t(s) * symbols + symbol;
+            int32_t n = next_state[t];
+            if(n < 0)
+                return compute(s, symbol, match);
+
+            match = match_id[t];
+            return n;
+        }
+
+        /**
+         * @brief Records cache misses, flushes and the work of computing
+         * transitions in a profile, if it is one of this automaton's program.
+         */
+        void set_profile(regex_profile* profile);
+
+        /** @brief Number of times the cache has been flushed. */
+        size_t flush_count() const { return flushes; }
+        /** @brief Number of transitions that had to be computed. */
+        size_t miss_count() const { return misses; }
+        /** @brief Number of cached states. */
+        size_t state_count() const { return states.size(); }
+    };
+
+    /**
+     * @brief Finds matches with a forward and a reverse automaton, without
+     * any backtracking.
+     *
+     * The forward automaton finds where the leftmost-longest match ends in a
+     * single pass, and the reverse one then reads back from there to find
+     * where it starts. Matches are leftmost-longest, as in POSIX, rather than
+     * leftmost-first like those of @c regex::search, so they may be longer
+     * when alternatives or reluctant quantifiers are involved.
+     *
+     * Like for @c regex_dfa itself, the pattern must be supported, and each
+     * thread needs its own searcher.
+     */
+    class regex_searcher {
+    private:
+        regex_dfa forward;
+        regex_dfa backward;
+        std::bitset<256> first;
+        bool nullable;
+
+    public:
+        regex_searcher(const regex& re, size_t max_bytes = regex_dfa::default_budget)
+         : forward(re, regex_dfa::unanchored | regex_dfa::leftmost, max_bytes),
+           backward(re, regex_dfa::reverse, max_bytes),
+           first(re.get_program().first), nullable(re.get_program().nullable) {}
+
+        /**
+         * @brief Finds the leftmost-longest match at or after a specified position.
+         *
+         * @param str the string to search.
+         * @param pos the position to start at.
+         * @param begin set to the position of the match, if there is one.
+         * @param len set to the length of the match, if there is one.
+         */
+        bool search(std::string_view str, size_t pos, size_t& begin, size_t& len);
+
+        /**
+         * @brief Whether any match ends at a specified position, which is what
+         * a lookbehind @c (?<=...) of the pattern would check.
+         */
+        bool ends_at(std::string_view str, size_t pos);
+
+        const regex_dfa& forward_dfa() const { return forward; }
+        const regex_dfa& reverse_dfa() const { return backward; }
+    };
+
+    /** @brief A match found by @c search_file. */
+    struct regex_file_match {
+        file_parser::source source;     //line (counting from 1) and column, as used by file_parser
+        size_t offset;                  //byte offset in the file
+        size_t length;
+    };
+
+    /**
+     * @brief Finds all non-overlapping matches of a pattern in a file, using
+     * several threads.
+     *
+     * The file is mapped into memory and split into chunks of whole lines,
+     * which are scanned in parallel. Lines are matched separately, like when
+     * matching against a @c file_parser (without continuation characters).
+     * Lines without matches are rejected by a @c regex_dfa if the pattern
+     * allows it, and the matches in the remaining ones are found by backtracking.
+     *
+     * @param re the pattern.
+     * @param filename the file.
+     * @param threads the number of threads, or zero to use one per core.
+     * @param err error message if the file can not be read; if empty, a default
+     *      message is used.
+     *
+     * @return the matches, in the order they appear in the file.
+     */
+    std::vector< regex_file_match > search_file(const regex& re, const std::string& filename,
+                                                size_t threads = 0, const std::string& err = "");
+
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef UTIL_REGEX_PROFILE_H
+#define UTIL_REGEX_PROFILE_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "regex.hpp"
+
+namespace util {
+
+    /**
+     * @brief Records where the effort of matching a pattern goes, to find out
+     * why a pattern is slow.
+     *
+     * For each instruction of the compiled pattern, and so for each part of
+     * the pattern, the profile counts how often it was executed, how often
+     * it failed and made the matcher backtrack, how much of the time it took,
+     * and how much work it caused a @c regex_dfa when computing transitions.
+     * It also counts the cache misses and flushes of such automata.
+     *
+     * Profiling is opt-in: attach the profile to a @c regex_stack (and/or a
+     * @c regex_dfa) with @c set_profile. Only matches of the profile's pattern
+     * going forwards are recorded. Measuring the time of every instruction
+     * makes matching several times slower, but unprofiled matches do not pay
+     * anything.
+     */
+    class regex_profile {
+    private:
+        friend class regex;
+        friend class regex_dfa;
+
+        using clock = std::chrono::steady_clock;
+
+        struct counters {
+            size_t visits;
+            size_t backtracks;
+            size_t dfa_work;
+            clock::duration time;
+        };
+
+        const regex& re;
+        std::vector< counters > insts;
+        size_t runs;
+        size_t dfa_misses;
+        size_t dfa_flushes;
+
+        clock::time_point last;
+        size_t last_pc;
+
+        bool covers(const detail::regex_program& prog) const { return &prog == &re.get_program(); }
+
+        void start(){
+            ++runs;
+            last_pc = std::string::npos;
+        }
+        void visit(size_t pc){
+            clock::time_point now = clock::now();
+            if(last_pc != std::string::npos)
+                insts[last_pc].time += now - last;
+            last = now;
+            last_pc = pc;
+            ++insts[pc].visits;
+        }
+        void backtrack(size_t pc){
+            ++insts[pc].backtracks;
+        }
+        void stop(){
+            if(last_pc != std::string::npos)
+                insts[last_pc].time += clock::now() - last;
+            last_pc = std::string::npos;
+        }
+
+        //Sums up the instructions compiled from each part of the pattern
+        std::vector< std::pair< std::pair<size_t, size_t>, counters > > nodes() const;
+        double share(clock::duration time) const;
+
+    public:
+        /** @brief Creates an empty profile of a pattern, which must outlive it. */
+        explicit regex_profile(const regex& re);
+
+        /** @brief Forgets everything recorded so far. */
+        void clear();
+
+        /** @brief Number of (attempted) matches recorded, including those of each search. */
+        size_t run_count() const { return runs; }
+
+        size_t visits(size_t pc) const { return insts[pc].visits; }
+        size_t backtracks(size_t pc) const { return insts[pc].backtracks; }
+        size_t dfa_work(size_t pc) const { return insts[pc].dfa_work; }
+        /** @brief The fraction of the total time spent on an instruction. */
+        double time_share(size_t pc) const { return share(insts[pc].time); }
+
+        size_t dfa_miss_count() const { return dfa_misses; }
+        size_t dfa_flush_count() const { return dfa_flushes; }
+
+        /**
+         * @brief The pattern, followed by one line for each of its parts that
+         * underlines the part and lists what was recorded for it.
+         */
+        std::string annotated() const;
+
+        /** @brief Everything recorded, per instruction and per part of the pattern, as JSON. */
+        std::string json() const;
+    };
+
+};
+
+#endif
@@ -28,6 +28,17 @@ std::string& util::convert_uppercase(std::string& str){
     return str;
 }
 
-bool util::word_char(const std::string& str, size_t pos){
+bool util::equal_icase(std::string_view a, std::string_view b){
+    if(a.length() != b.length())
+        return false;
+
+    for(size_t i = 0; i < a.length(); ++i)
+        if(lower_char(a[i]) != lower_char(b[i]))
+            return false;
+
+    return true;
+}
+
+bool util::word_char(std::string_view str, size_t pos){
     return pos < str.size() && (std::isalnum(str[pos]) || str[pos] == '_');
 }
@@ -13,15 +13,15 @@ using namespace util;
 const std::string file_parser::whitespace = " \t\n\r\v\f";
 const std::string file_parser::code_chars = std::string("\00\01\02\03\04\05\06\07\10\11\12\13\14\15\16\17\20\21\22\23\24\25\26\27\30\31\32\33\34\35\36\37", 040);
 
-file_parser::file_parser()
+file_parser::file_parser(std::pmr::memory_resource* resource)
  : filename(""), in(nullptr), owns_in(false),
    out(nullptr), echo(false), owns_out(false), echo_prefix(""),
    cont_char(0),
    min_line(0), max_line(0), line(0), col(0),
-   marks(), bufs({{"", 0}})
+   marks(std::pmr::deque<mark_location>(resource)), bufs({{"", 0}}, resource)
 {}
-file_parser::file_parser(std::istream& ist)
- : file_parser()
+file_parser::file_parser(std::istream& ist, std::pmr::memory_resource* resource)
+ : file_parser(resource)
 {
     filename = "<input stream>";
     in = &ist;
@@ -30,8 +30,8 @@ file_parser::file_parser(std::istream& ist)
     skip_byte_order_mark();
 }
 
-file_parser::file_parser(const std::string& filename, const std::string& err)
- : file_parser()
+file_parser::file_parser(const std::string& filename, const std::string& err, std::pmr::memory_resource* resource)
+ : file_parser(resource)
 {
     this->filename = filename;
     in = new std::ifstream(filename);
@@ -83,7 +83,7 @@ void file_parser::disable_echoing(){
 }
 
 bool file_parser::get_line(const std::string& err){
-    std::string tmp_buf;
+    std::pmr::string tmp_buf(bufs.get_allocator());
         
     if(!std::getline(*in, tmp_buf)){
         bufs.push_front( std::make_pair("", 0) );
@@ -108,7 +108,7 @@ bool file_parser::get_line(const std::string& err){
         std::swap(BUF, tmp_buf);
     }
     else
-        bufs.push_front( std::make_pair(tmp_buf, 0) );
+        bufs.emplace_front(std::move(tmp_buf), 0);
     
     
     while(!BUF.empty() && BUF[BUF.length() - 1] == cont_char){
@@ -344,7 +344,7 @@ bool file_parser::match_impl(const std::string& str, size_t opts, const std::str
         error(err);
 }
 
-const std::string& file_parser::get_buffer() const {
+std::string_view file_parser::get_buffer() const {
     return BUF;
 }
 size_t file_parser::get_column() const {
@@ -419,7 +419,7 @@ bool file_parser::substr(std::ostream& out, size_t flags, const std::string& chr
     }
         
     for(size_t tmp_line = begin_line; tmp_line <= end_line; ++tmp_line){
-        std::string& tmp_buf = bufs[max_line - tmp_line].first;
+        const std::pmr::string& tmp_buf = bufs[max_line - tmp_line].first;
         
         for(
             size_t tmp_col = (tmp_line == begin_line ? begin_col : 0); 
@@ -480,7 +480,7 @@ void file_parser::error(const std::string& message, const std::string& str, size
 void file_parser::error(bool show_context, const std::string& message) const{
     error(show_context, message, BUF, col);
 }
-void file_parser::error(bool show_context, const std::string& message, const std::string& buf, size_t pos, bool compute_offset) const {
+void file_parser::error(bool show_context, const std::string& message, std::string_view buf, size_t pos, bool compute_offset) const {
     
 #if UTIL_FILE_PARSER_ERROR_THROW
     std::ostrinstream err;
@@ -510,7 +510,7 @@ void file_parser::error(bool show_context, const std::string& message, const std
 #endif
     
 }
-void file_parser::show_error_context(std::ostream& err, const std::string& buf, size_t pos){
+void file_parser::show_error_context(std::ostream& err, std::string_view buf, size_t pos){
     const size_t max_print_length = 64;
     
     if(pos >= buf.length())
@@ -0,0 +1,257 @@
+#include "../keyword_image.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace util;
+using detail::keyword_image;
+
+static void image_error(const std::string& message){
+
+#if UTIL_KEYWORD_IMAGE_ERROR_THROW
+    std::ostringstream err;
+#    define ERR_STR err
+#else
+#    define ERR_STR std::cerr
+#endif
+
+    ERR_STR << "\nERROR: " << message << "\n\n";
+
+#if UTIL_KEYWORD_IMAGE_ERROR_THROW
+    throw keyword_image_error(err.str());
+#else
+    exit(EXIT_FAILURE);
+#endif
+
+#undef ERR_STR
+}
+
+namespace {
+    constexpr char image_magic[8] = {'U', 'T', 'I', 'L', 'K', 'W', 'I', 'M'};
+    constexpr uint32_t image_version = 1;
+    constexpr uint32_t image_byte_order = 0x01020304;
+
+    //The start of an image. The tables follow at the given offsets from the
+    //start of the image, each aligned to its elements.
+    struct image_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;        //image_byte_order, as written
+        uint64_t size;              //of the whole image
+        uint64_t checksum;          //of everything after the header
+        uint64_t count;
+        uint64_t num_lengths;
+        uint32_t value_kind;
+        uint32_t value_size;
+        uint64_t value_align;
+        uint64_t seeds;             //int32_t[count]
+        uint64_t lengths;           //uint64_t[num_lengths]
+        uint64_t key_offsets;       //uint32_t[count + 1]
+        uint64_t key_chars;
+        uint64_t values;            //value_size bytes each, or the chars of the strings
+        uint64_t value_offsets;     //uint32_t[count + 1], for strings
+    };
+}
+
+//FNV-1a over 8 bytes at a time, which is fast enough to check large images
+static uint64_t image_checksum(const char* data, size_t size){
+    uint64_t h = 0xcbf29ce484222325;
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8){
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0x100000001b3;
+    }
+    for(; i < size; ++i)
+        h = (h ^ (unsigned char) data[i]) * 0x100000001b3;
+    return detail::frozen_mix(h, size);
+}
+
+void detail::write_frozen_image(const std::string& filename, const frozen_image_parts& parts){
+    const size_t n = parts.count;
+    const size_t align = std::max<size_t>(8, parts.value_align);
+
+    if(parts.value_kind == frozen_string_values && parts.values.length() > UINT32_MAX)
+        image_error("The values are too long for a keyword image: " + filename);
+
+    std::string image(sizeof(image_header), '\0');
+    auto section = [&](const void* bytes, size_t size, size_t at){
+        image.resize((image.length() + at - 1) / at * at, '\0');
+        size_t offset = image.length();
+        if(size > 0)
+            image.append(static_cast<const char*>(bytes), size);
+        return offset;
+    };
+
+    std::vector< uint64_t > lengths(parts.lengths, parts.lengths + parts.num_lengths);
+    const uint32_t no_offsets[1] = {0};
+
+    image_header head = {};
+    std::memcpy(head.magic, image_magic, sizeof(image_magic));
+    head.version     = image_version;
+    head.byte_order  = image_byte_order;
+    head.count       = n;
+    head.num_lengths = parts.num_lengths;
+    head.value_kind  = parts.value_kind;
+    head.value_size  = parts.value_size;
+    head.value_align = parts.value_align;
+    head.seeds       = section(parts.seeds, n * sizeof(int32_t), 8);
+    head.lengths     = section(lengths.data(), lengths.size() * sizeof(uint64_t), 8);
+    head.key_offsets = section(parts.key_offsets ? parts.key_offsets : no_offsets, (n + 1) * sizeof(uint32_t), 8);
+    head.key_chars   = section(parts.key_chars.data(), parts.key_chars.length(), 8);
+    if(parts.value_kind == frozen_string_values)
+        head.value_offsets = section(parts.value_offsets, (n + 1) * sizeof(uint32_t), 8);
+    head.values      = section(parts.values.data(), parts.values.length(), align);
+    head.size        = image.length();
+    head.checksum    = image_checksum(image.data() + sizeof(head), image.length() - sizeof(head));
+    std::memcpy(&image[0], &head, sizeof(head));
+
+    //Write a new file and rename it over the old one, which may still be mapped
+    std::string temp = filename + ".tmp";
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    out.write(image.data(), image.length());
+    out.close();
+    if(!out || std::rename(temp.c_str(), filename.c_str()) != 0){
+        std::remove(temp.c_str());
+        image_error("Could not write keyword image: " + filename);
+    }
+}
+
+keyword_image::keyword_image(const std::string& filename, frozen_value_kind kind,
+                             size_t value_size, size_t value_align, bool verify)
+ : data(nullptr), length(0), mapped(false), n(0), num_lengths(0), seeds(nullptr), lengths(nullptr),
+   key_offsets(nullptr), key_chars(nullptr), values(nullptr), value_offsets(nullptr)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        image_error("File not found: " + filename);
+
+    struct stat info;
+    if(fstat(fd, &info) != 0){
+        close(fd);
+        image_error("Could not read file: " + filename);
+    }
+
+    length = info.st_size;
+    if(length < sizeof(image_header)){
+        close(fd);
+        image_error("Not a keyword image: " + filename);
+    }
+
+    void* map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        image_error("Could not map file: " + filename);
+    data = static_cast<const char*>(map);
+    mapped = true;
+
+    std::string err = load(kind, value_size, value_align, verify);
+    if(!err.empty()){
+        release();
+        image_error(err + ": " + filename);
+    }
+}
+
+keyword_image::keyword_image(keyword_image&& other) noexcept
+ : data(other.data), length(other.length), mapped(other.mapped), n(other.n), num_lengths(other.num_lengths),
+   seeds(other.seeds), lengths(other.lengths), key_offsets(other.key_offsets), key_chars(other.key_chars),
+   values(other.values), value_offsets(other.value_offsets)
+{
+    other.mapped = false;
+}
+
+keyword_image& keyword_image::operator= (keyword_image&& other) noexcept {
+    if(this != &other){
+        release();
+        data          = other.data;
+        length        = other.length;
+        mapped        = other.mapped;
+        n             = other.n;
+        num_lengths   = other.num_lengths;
+        seeds         = other.seeds;
+        lengths       = other.lengths;
+        key_offsets   = other.key_offsets;
+        key_chars     = other.key_chars;
+        values        = other.values;
+        value_offsets = other.value_offsets;
+        other.mapped  = false;
+    }
+    return *this;
+}
+
+keyword_image::~keyword_image(){
+    release();
+}
+
+void keyword_image::release(){
+    if(mapped)
+        munmap(const_cast<char*>(data), length);
+    mapped = false;
+}
+
+std::string keyword_image::load(frozen_value_kind kind, size_t value_size, size_t value_align, bool verify){
+    image_header head;
+    if(length < sizeof(head))
+        return "Not a keyword image";
+
+    std::memcpy(&head, data, sizeof(head));
+    if(std::memcmp(head.magic, image_magic, sizeof(image_magic)) != 0)
+        return "Not a keyword image";
+    if(head.byte_order != image_byte_order)
+        return "Keyword image of another byte order";
+    if(head.version != image_version)
+        return "Keyword image of unsupported version " + std::to_string(head.version);
+    if(head.size != length)
+        return "Truncated keyword image";
+    if(head.value_kind != kind || head.value_size != value_size || head.value_align != value_align)
+        return "Keyword image of other values";
+    if(verify && image_checksum(data + sizeof(head), length - sizeof(head)) != head.checksum)
+        return "Corrupted keyword image";
+
+    //Each table must lie within the image, aligned to its elements
+    auto fits = [&](uint64_t offset, uint64_t count, size_t size, size_t align){
+        return offset >= sizeof(head) && offset <= length && offset % align == 0
+            && count <= (length - offset) / size;
+    };
+
+    if(head.count >= length || head.num_lengths > head.count
+       || !fits(head.seeds, head.count, sizeof(int32_t), alignof(int32_t))
+       || !fits(head.lengths, head.num_lengths, sizeof(uint64_t), alignof(uint64_t))
+       || !fits(head.key_offsets, head.count + 1, sizeof(uint32_t), alignof(uint32_t)))
+        return "Corrupted keyword image";
+
+    n             = head.count;
+    num_lengths   = head.num_lengths;
+    seeds         = reinterpret_cast<const int32_t*>(data + head.seeds);
+    lengths       = reinterpret_cast<const uint64_t*>(data + head.lengths);
+    key_offsets   = reinterpret_cast<const uint32_t*>(data + head.key_offsets);
+    key_chars     = data + head.key_chars;
+
+    if(!fits(head.key_chars, key_offsets[n], 1, 1))
+        return "Corrupted keyword image";
+
+    if(kind == frozen_fixed_values){
+        if(!fits(head.values, n, value_size, value_align))
+            return "Corrupted keyword image";
+    }
+    else if(kind == frozen_string_values){
+        if(!fits(head.value_offsets, n + 1, sizeof(uint32_t), alignof(uint32_t)))
+            return "Corrupted keyword image";
+        value_offsets = reinterpret_cast<const uint32_t*>(data + head.value_offsets);
+        if(!fits(head.values, value_offsets[n], 1, 1))
+            return "Corrupted keyword image";
+    }
+    values = data + head.values;
+
+    return "";
+}
@@ -0,0 +1,153 @@
+#include "../keyword_trie.hpp"
+#include "../file_parser.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+using namespace util;
+using detail::keyword_trie;
+using detail::keyword_automaton;
+using detail::keyword_prefilter;
+using detail::keyword_bloom;
+
+keyword_prefilter::keyword_prefilter(const keyword_trie& trie)
+ : width(0), exact(), low(), high()
+{
+    std::vector< std::string > keys;
+    trie.for_each([&](const std::string& key, uint32_t){
+        if(!key.empty())
+            keys.push_back(key);
+    });
+    if(keys.empty() || keys.size() > max_keywords)
+        return;
+
+    width = 3;
+    for(const std::string& key : keys)
+        width = std::min(width, key.length());
+
+    //Neighbours in sorted order share their first bytes, so they share buckets
+    for(size_t k = 0; k < keys.size(); ++k){
+        unsigned char bucket = 1 << (k * 8 / keys.size());
+        for(size_t j = 0; j < width; ++j){
+            unsigned char byte = keys[k][j];
+            exact[j][byte] |= bucket;
+            low[j][byte & 0xf] |= bucket;
+            high[j][byte >> 4] |= bucket;
+        }
+    }
+}
+
+size_t keyword_prefilter::next(std::string_view str, size_t from) const {
+    if(str.length() < width)
+        return std::string::npos;
+
+    size_t i = from;
+
+#if defined(__SSSE3__)
+    const __m128i nibble = _mm_set1_epi8(0xf);
+    const __m128i zero = _mm_setzero_si128();
+
+    for(; i + 16 + width - 1 <= str.length(); i += 16){
+        __m128i found = _mm_set1_epi8(-1);
+        for(size_t j = 0; j < width; ++j){
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str.data() + i + j));
+            __m128i lo = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(low[j])),
+                                          _mm_and_si128(bytes, nibble));
+            __m128i hi = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(high[j])),
+                                          _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+            found = _mm_and_si128(found, _mm_and_si128(lo, hi));
+        }
+
+        //Weed out the candidates let through by splitting the bytes
+        unsigned candidates = ~_mm_movemask_epi8(_mm_cmpeq_epi8(found, zero)) & 0xffff;
+        for(; candidates; candidates &= candidates - 1){
+            size_t pos = i + __builtin_ctz(candidates);
+            if(candidate(str, pos))
+                return pos;
+        }
+    }
+#endif
+
+    for(; i + width <= str.length(); ++i)
+        if(candidate(str, i))
+            return i;
+
+    return std::string::npos;
+}
+
+keyword_automaton::keyword_automaton(const keyword_trie& trie)
+ : fail(trie.node_count(), 0, trie.resource()), dict(trie.node_count(), keyword_trie::none, trie.resource()),
+   depth(trie.node_count(), 0, trie.resource()),
+   prefilter(trie)
+{
+    //Breadth-first, so the suffixes of a node are done before the node itself
+    std::vector< uint32_t > queue(1, 0);
+    for(size_t head = 0; head < queue.size(); ++head){
+        uint32_t u = queue[head];
+
+        for(uint32_t v = trie.at(u).child; v != keyword_trie::none; v = trie.at(v).sibling){
+            depth[v] = depth[u] + 1;
+
+            if(u != 0)
+                fail[v] = next(trie, fail[u], trie.at(v).byte);
+
+            uint32_t f = fail[v];
+            dict[v] = (f != 0 && trie.at(f).id != keyword_trie::none) ? f : dict[f];
+
+            queue.push_back(v);
+        }
+    }
+}
+
+std::string_view detail::parser_buffer(const file_parser& parser){
+    return parser.get_buffer();
+}
+size_t detail::parser_column(const file_parser& parser){
+    return parser.get_column();
+}
+void detail::parser_move_to(file_parser& parser, size_t col){
+    parser += col - parser.get_column();
+}
+bool detail::parser_next_line(file_parser& parser){
+    return parser.advance_line();
+}
+
+std::vector< fuzzy_match > detail::closest_keywords(const keyword_trie& trie, std::string_view str,
+                                                    size_t max_edits, size_t max_results){
+    std::vector< fuzzy_match > found;
+    for(size_t edits = 0; edits <= max_edits && found.size() < max_results; ++edits){
+        trie.for_each_fuzzy(str, edits, [&](const std::string& key, uint32_t id, size_t dist){
+            if(dist == edits)
+                found.push_back({key, dist, id});
+            return found.size() < max_results;
+        });
+    }
+    return found;
+}
+
+keyword_bloom::keyword_bloom(size_t capacity, double rate, std::pmr::memory_resource* resource)
+ : words(resource), num_blocks(0), num_bits(0), capacity(std::max<size_t>(capacity, 1)), count(0),
+   rate(std::min(std::max(rate, 1e-9), 0.5)), hits(0), misses(0), false_positives(0)
+{
+    //The optimal number of bits per keyword, and of bits set by each, for
+    //an unblocked filter; blocks fill unevenly, which some more bits make up for
+    double bits_per_key = -std::log(this->rate) / (std::log(2.0) * std::log(2.0));
+    num_bits = std::min(16.0, std::max(1.0, std::round(bits_per_key * std::log(2.0))));
+
+    double bits = std::ceil(this->capacity * bits_per_key * 1.2);
+    num_blocks = std::max<size_t>(1, size_t(bits / 512) + 1);
+    words.assign(num_blocks * block_words + block_words - 1, 0);
+}
+
+keyword_bloom::keyword_bloom(const keyword_bloom& other, std::pmr::memory_resource* resource)
+ : words(other.words.size(), 0, resource), num_blocks(other.num_blocks), num_bits(other.num_bits),
+   capacity(other.capacity), count(other.count), rate(other.rate),
+   hits(other.hits.load()), misses(other.misses.load()), false_positives(other.false_positives.load())
+{
+    //The copy may start at another offset from a cache line
+    std::copy_n(block(other.words, num_blocks, 0), num_blocks * block_words, block(words, num_blocks, 0));
+}
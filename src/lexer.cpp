@@ -0,0 +1,239 @@
+#include "../lexer.hpp"
+#include "../regex_dfa.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+using namespace util;
+using detail::regex_inst;
+using detail::regex_program;
+
+static void lexer_error(const std::string& message){
+
+#if UTIL_REGEX_ERROR_THROW
+    std::ostringstream err;
+#    define ERR_STR err
+#else
+#    define ERR_STR std::cerr
+#endif
+
+    ERR_STR << "\nERROR: " << message << "\n\n";
+
+#if UTIL_REGEX_ERROR_THROW
+    throw regex_error(err.str());
+#else
+    exit(EXIT_FAILURE);
+#endif
+
+#undef ERR_STR
+}
+
+//Appends a compiled pattern to a combined program, making its matches report id
+static void append(regex_program& out, const regex_program& in, uint32_t id){
+    uint32_t base = out.code.size();
+    uint32_t cls  = out.classes.size();
+
+    for(regex_inst inst : in.code){
+        switch(inst.op){
+            case regex_inst::CLASS:
+            case regex_inst::RUN:
+                inst.x += cls;
+                break;
+            case regex_inst::SPLIT:
+                inst.x += base;
+                inst.y += base;
+                break;
+            case regex_inst::JUMP:
+                inst.x += base;
+                break;
+            case regex_inst::ATOMIC:
+            case regex_inst::LOOK:
+                inst.y += base;
+                break;
+            case regex_inst::MATCH:
+                inst.x = id;
+                break;
+            default:
+                break;
+        }
+        out.code.push_back(inst);
+    }
+
+    out.classes.insert(out.classes.end(), in.classes.begin(), in.classes.end());
+}
+
+//Splits the bytes into classes that no instruction (and no word boundary)
+//can tell apart, and returns the number of classes, including that of the
+//end of the input
+static uint32_t byte_classes(const regex_program& prog, std::vector<uint16_t>& classes){
+    std::vector< std::bitset<256> > sets = prog.classes;
+    for(const regex_inst& inst : prog.code){
+        if(inst.op == regex_inst::CHAR){
+            sets.emplace_back();
+            sets.back().set(inst.x);
+        }
+    }
+    sets.emplace_back();
+    for(unsigned c = 0; c < 256; ++c)
+        sets.back()[c] = std::isalnum(c) || c == '_';
+
+    classes.assign(257, 0);
+    uint32_t count = 1;
+    for(const auto& set : sets){
+        std::map< std::pair<uint16_t, bool>, uint16_t > refined;
+        for(unsigned c = 0; c < 256; ++c){
+            auto it = refined.try_emplace({classes[c], set[c]}, uint16_t(refined.size())).first;
+            classes[c] = it->second;
+        }
+        count = refined.size();
+    }
+
+    classes[256] = count;
+    return count + 1;
+}
+
+lexer::lexer(const std::vector< lexer_rule >& rules, const keyword_map<int32_t>& keywords,
+             size_t flags, size_t max_states)
+ : classes(), next(), accept(), tabs()
+{
+    std::vector< std::pair<std::string, int32_t> > words;
+    keywords.for_each([&](const std::string& key, int32_t token){
+        if(!key.empty())
+            words.emplace_back(key, token);
+    });
+    std::sort(words.begin(), words.end());
+
+    size_t count = words.size() + rules.size();
+    if(count == 0)
+        lexer_error("A lexer needs at least one rule or reserved word");
+
+    //Try all entries in order of priority, which is also the order of their
+    //match ids, so the automaton reports the first one matching
+    regex_program prog;
+    prog.num_groups = 1;
+    prog.num_slots = 2;
+    std::vector< int32_t > tokens;
+
+    for(size_t i = 0; i < count; ++i){
+        if(i + 1 < count)
+            prog.code.push_back({regex_inst::SPLIT, false, 0, uint32_t(i + 1)});
+        else
+            prog.code.push_back({regex_inst::JUMP, false, 0, 0});
+    }
+
+    for(const auto& [word, token] : words){
+        prog.code[tokens.size()].x = prog.code.size();
+
+        for(char ch : word){
+            if((flags & regex::icase) && lower_char(ch) != upper_char(ch)){
+                std::bitset<256> both;
+                both.set((unsigned char) lower_char(ch));
+                both.set((unsigned char) upper_char(ch));
+                prog.code.push_back({regex_inst::CLASS, false, uint32_t(prog.classes.size()), 0});
+                prog.classes.push_back(both);
+            }
+            else
+                prog.code.push_back({regex_inst::CHAR, false, (unsigned char) ch, 0});
+        }
+        prog.code.push_back({regex_inst::MATCH, false, uint32_t(tokens.size()), 0});
+        tokens.push_back(token);
+    }
+
+    for(const lexer_rule& rule : rules){
+        regex re(rule.pattern, flags);
+        if(!regex_dfa::supports(re))
+            lexer_error("Lexer rule \"" + rule.pattern + "\" uses backreferences, lookaround, "
+                        "atomic groups or possessive quantifiers");
+
+        prog.code[tokens.size()].x = prog.code.size();
+        append(prog, re.get_program(), tokens.size());
+        tokens.push_back(rule.token);
+    }
+
+    uint32_t n = byte_classes(prog, classes);
+    std::vector< unsigned > representative(n, regex_dfa::end_symbol);
+    for(unsigned c = 256; c-- > 0; )
+        representative[classes[c]] = c;
+
+    //Build the whole automaton, numbering its states in the order they are found
+    regex_dfa dfa(prog, 0, std::numeric_limits<size_t>::max());
+
+    std::vector< uint32_t > number(1, 0);
+    std::vector< uint32_t > found(1, regex_dfa::dead);
+    auto state_number = [&](uint32_t s){
+        if(s >= number.size())
+            number.resize(s + 1, uint32_t(-1));
+        if(number[s] == uint32_t(-1)){
+            if(found.size() >= max_states)
+                lexer_error("Lexer needs more than " + std::to_string(max_states) + " states");
+            number[s] = found.size();
+            found.push_back(s);
+        }
+        return number[s];
+    };
+
+    tabs.num_classes = n;
+    for(unsigned k = 0; k < 4; ++k)
+        tabs.start[k] = state_number(dfa.start(k & 1, k & 2));
+
+    for(size_t i = 0; i < found.size(); ++i){
+        for(uint32_t c = 0; c < n; ++c){
+            int32_t match;
+            uint32_t to = dfa.next(found[i], representative[c], match);
+
+            next.push_back(i ? state_number(to) : 0);
+            accept.push_back(i && match >= 0 ? tokens[match] : -1);
+        }
+    }
+
+    tabs.classes = classes.data();
+    tabs.next    = next.data();
+    tabs.accept  = accept.data();
+}
+
+std::vector< lexer_token > lexer::tokenize(std::string_view str) const {
+    std::vector< lexer_token > tokens;
+
+    lexer_token tok;
+    for(size_t pos = 0; pos < str.length(); ){
+        if(next_token(str, pos, tok)){
+            tokens.push_back(tok);
+            pos += tok.length;
+        }
+        else
+            ++pos;
+    }
+
+    return tokens;
+}
+
+template<typename T>
+static void emit_array(std::ostream& out, const char* type, const std::string& name, const std::vector<T>& values){
+    out << "constexpr " << type << " " << name << "[" << values.size() << "] = {";
+    for(size_t i = 0; i < values.size(); ++i){
+        if(i % 16 == 0)
+            out << "\n    ";
+        out << values[i] << (i + 1 < values.size() ? ", " : "");
+    }
+    out << "\n};\n";
+}
+
+std::string lexer::emit_source(const std::string& name) const {
+    std::ostringstream out;
+
+    out << "//Generated by util::lexer: " << state_count() << " states, "
+        << tabs.num_classes << " byte classes; needs lexer.hpp\n";
+
+    emit_array(out, "uint16_t", name + "_classes", classes);
+    emit_array(out, "uint32_t", name + "_next", next);
+    emit_array(out, "int32_t",  name + "_accept", accept);
+
+    out << "constexpr util::lexer_tables " << name << " = {\n    "
+        << name << "_classes, " << name << "_next, " << name << "_accept, "
+        << tabs.num_classes << ", {"
+        << tabs.start[0] << ", " << tabs.start[1] << ", " << tabs.start[2] << ", " << tabs.start[3] << "}\n};\n";
+
+    return out.str();
+}
@@ -1,247 +1,1284 @@
 #include "../regex.hpp"
+#include "../char_utils.hpp"
+#include "../file_parser.hpp"
+#include "../regex_profile.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
 
 using namespace util;
+using detail::regex_inst;
+using detail::regex_program;
+
+#define NPOS std::string::npos
+
+namespace util {
+namespace detail {
+
+    //Recursive descent parser turning a pattern into a tree of regex_impl nodes.
+    class regex_parser {
+    private:
+        const std::string& pat;
+        size_t pos;
+        size_t groups;
+        bool icase;
+
+        void error(const std::string& message) const;
+
+        bool at_end() const { return pos >= pat.length(); }
+        bool peek(char ch) const { return pos < pat.length() && pat[pos] == ch; }
+        bool peek(const std::string& str) const { return pat.compare(pos, str.length(), str) == 0; }
+
+        std::unique_ptr<regex_impl> parse_alternative();
+        std::unique_ptr<regex_impl> parse_sequence();
+        std::unique_ptr<regex_impl> parse_repetition();
+        std::unique_ptr<regex_impl> parse_atom();
+        std::unique_ptr<regex_impl> parse_group();
+        std::unique_ptr<regex_impl> parse_escape();
+        std::bitset<256> parse_class();
+        std::unique_ptr<regex_impl> make_char(char ch) const;
+
+        bool parse_count(size_t& count);
+        char parse_escaped_char();
+        static bool class_escape(char ch, std::bitset<256>& chars);
+
+        static bool plain_literal(const regex_impl& node);
+        static std::unique_ptr<regex_impl> wrap(std::unique_ptr<regex_impl>&& node);
+
+    public:
+        regex_parser(const std::string& pat, bool icase) : pat(pat), pos(0), groups(0), icase(icase) {}
+
+        std::unique_ptr<regex_impl> parse();
+
+        size_t group_count() const { return groups + 1; }
+    };
+
+}
+}
+
+using detail::regex_parser;
+
+static const size_t max_count = 1000;
+
+void regex_parser::error(const std::string& message) const {
+
+#if UTIL_REGEX_ERROR_THROW
+    std::ostringstream err;
+#    define ERR_STR err
+#else
+#    define ERR_STR std::cerr
+#endif
+
+    ERR_STR << "\nERROR in regex \"" << pat << "\", position " << pos;
+    ERR_STR << "\nERROR: " << message << "\n\n";
+    ERR_STR << "\t" << pat << "\n";
+    ERR_STR << "\t" << std::string(std::min(pos, pat.length()), '_') << "^\n\n";
+
+#if UTIL_REGEX_ERROR_THROW
+    throw regex_error(err.str());
+#else
+    exit(EXIT_FAILURE);
+#endif
+
+#undef ERR_STR
+}
+
+std::unique_ptr<regex_impl> regex_parser::parse(){
+    auto root = parse_alternative();
+
+    if(!at_end())
+        error("Unmatched ')'");
 
+    return root;
+}
+
+std::unique_ptr<regex_impl> regex_parser::parse_alternative(){
+    auto head = parse_sequence();
+
+    if(!peek('|'))
+        return head;
+
+    ++pos;
+    size_t begin = head->begin;
+    auto node = std::make_unique<alternative>(std::move(head), parse_alternative());
+    node->begin = begin;
+    node->end = pos;
+    return node;
+}
+
+std::unique_ptr<regex_impl> regex_parser::parse_sequence(){
+    std::vector< std::unique_ptr<regex_impl> > items;
+
+    while(!at_end() && !peek('|') && !peek(')')){
+        auto item = parse_repetition();
+
+        //Merge runs of single characters into one literal
+        if(!items.empty() && plain_literal(*items.back()) && plain_literal(*item)){
+            static_cast<literal&>(*items.back()).str += static_cast<literal&>(*item).str;
+            items.back()->end = item->end;
+        }
+        else
+            items.push_back(std::move(item));
+    }
+
+    if(items.empty()){
+        auto empty = std::make_unique<literal>("");
+        empty->begin = empty->end = pos;
+        return empty;
+    }
 
-    //Different types match differently, but they all have the same behaviour:
-    // - they set the mark
-    // - they advance the parser (forwards or backwards)
-    // - if they match, they
-    //   - set match to true,
-    //   - set len to the length of the match,
-    //   - push an attempt(len, rep, alt [optional] )
-    // - if they do not, they
-    //   - revert to and unset the mark
-    //   - leave match false.
-
-bool literal::match_single(file_parser& parser, size_t rep, size_t& len){
-
-    if(parser.match(string, !(modifier & LOOKAHEAD_MODIFIER)){
-        len = string.length()
-        push_attempt(len, rep);
-    }
-    
-bool regex::match_single(file_parser& parser, size_t rep, size_t& len){
-    
-    parser.set_mark();
-    
-    bool match = false;
-    
-    
-    switch(type){
-        case LITERAL:
-            if(parser.match(string)){
-                len = string.length()
-                attempts.push( attempt(len, rep) );
-                match = true;
+    std::unique_ptr<regex_impl> seq = std::move(items.back());
+    for(size_t i = items.size() - 1; i > 0; --i){
+        size_t begin = items[i-1]->begin, end = seq->end;
+        seq = std::make_unique<sequence>(std::move(items[i-1]), std::move(seq));
+        seq->begin = begin;
+        seq->end = end;
+    }
+
+    return seq;
+}
+
+std::unique_ptr<regex_impl> regex_parser::parse_repetition(){
+    size_t begin = pos;
+    auto node = parse_atom();
+    node->begin = begin;
+    node->end = pos;
+
+    for(;;){
+        size_t min, max, number;
+        size_t start = pos;
+
+        if(peek('*')){
+            ++pos;
+            min = 0;    max = regex_impl::unbounded;    number = regex_impl::ZERO_OR_MORE;
+        }
+        else if(peek('+')){
+            ++pos;
+            min = 1;    max = regex_impl::unbounded;    number = regex_impl::ONE_OR_MORE;
+        }
+        else if(peek('?')){
+            ++pos;
+            min = 0;    max = 1;                        number = regex_impl::ZERO_OR_ONE;
+        }
+        else if(peek('{')){
+            ++pos;
+            if(!parse_count(min)){
+                //Not a quantifier after all: a literal brace
+                pos = start;
+                return node;
             }
-            break;
-            
-        case CHAR_CLASS:
-            if(parser && string.find(*parser) != NPOS){
-                len = 1;
-                attempts.push( attempt(len, rep) );
-                match = true;
+
+            if(peek('}')){
+                max = min;
+                number = regex_impl::MIN_UPTO_MAX;
             }
-            break;
-            
-        case COMPLEX:
-            match = match_alternative(parser, alternatives.begin(), rep, len);
-            break;
-            
-    }
-    
-    if(match){
-        if(modifier & LOOKAHEAD_MODIFIER)
-            parser.revert_to_mark( parser::keep_mark );
-        
-        return true;
-    }
-    else{
-        parser.revert_to_mark( parser::remove_mark );
-        
+            else if(peek(",}")){
+                ++pos;
+                max = regex_impl::unbounded;
+                number = regex_impl::MIN_OR_MORE;
+            }
+            else if(peek(',')){
+                ++pos;
+                if(!parse_count(max) || !peek('}')){
+                    pos = start;
+                    return node;
+                }
+                if(max < min)
+                    error("Invalid repetition count: maximum is less than minimum");
+                number = regex_impl::MIN_UPTO_MAX;
+            }
+            else{
+                pos = start;
+                return node;
+            }
+            ++pos;
+        }
+        else
+            return node;
+
+        size_t end = pos;
+        size_t backtrack = regex_impl::GREEDY;
+        if(peek('?')){
+            ++pos;
+            backtrack = regex_impl::RELUCTANT;
+        }
+        else if(peek('+')){
+            ++pos;
+            backtrack = regex_impl::POSSESSIVE;
+        }
+
+        //Quantifiers are outermost, so a repeated node must be nested to be repeated again
+        if(node->min_rep != 1 || node->max_rep != 1)
+            node = wrap(std::move(node));
+
+        node->min_rep = min;
+        node->max_rep = max;
+        node->modifier &= ~(regex_impl::NUMBER_MODIFIER | regex_impl::BACKTRACK_MODIFIER);
+        node->modifier |= number | backtrack;
+        node->source = end;
+        node->end = pos;
+    }
+}
+
+bool regex_parser::parse_count(size_t& count){
+    if(at_end() || !std::isdigit((unsigned char) pat[pos]))
         return false;
+
+    count = 0;
+    while(!at_end() && std::isdigit((unsigned char) pat[pos])){
+        count = 10*count + (pat[pos] - '0');
+        if(count > max_count)
+            error("Repetition count too large (at most " + std::to_string(max_count) + " allowed)");
+        ++pos;
     }
-    
-    
+
+    return true;
 }
 
-bool regex::match_alternative(file_parser& parser, regex::alt_list::iterator begin, 
-                          size_t rep, size_t& len){
-    
-    for(auto alt_iter = begin; alt_iter != alternatives.end(); ++alt_iter){
-        if(match_sequence(parser, alt_iter->begin(), *alt_iter, len)){
-            attempts.push_back( attempt(sub_len, rep, alt_iter) );
-            return true;
+std::unique_ptr<regex_impl> regex_parser::parse_atom(){
+    char ch = pat[pos];
+
+    switch(ch){
+        case '(':
+            return parse_group();
+
+        case '[':
+            ++pos;
+            return std::make_unique<char_class>(parse_class());
+
+        case '.': {
+            ++pos;
+            std::bitset<256> all;
+            all.set();
+            all.reset('\n');
+            return std::make_unique<char_class>(all);
         }
+
+        case '^':
+            ++pos;
+            return std::make_unique<assertion>(assertion::BEGIN);
+        case '$':
+            ++pos;
+            return std::make_unique<assertion>(assertion::END);
+
+        case '\\':
+            ++pos;
+            return parse_escape();
+
+        case '*':
+        case '+':
+        case '?':
+            error("Nothing to repeat");
+            return nullptr;
+
+        default:
+            ++pos;
+            return make_char(ch);
     }
-    
-    return false;
 }
 
-bool regex::match_sequence(file_parser& parser, 
-                              regex::seq_list::iterator start, regex::seq_list& list, 
-                              size_t& len){
-    len = 0;
-    size_t sub_len;
-    for(auto seq_iter = start; seq_iter != list.end(); ){
-        auto& sub = *seq_iter;
-        sub_len = 0;
-        
-        //If we have a match, advance to next in sequence
-        if(sub->match(parser, sub_len)){
-            len += sub_len;
-            ++seq_iter;
-        }
-        //Otherwise, backtrack!
-        else{
-            for(;;){                
-                //If we can't backtrack, report the failure of this alternative
-                if(seq_iter == list.begin())
-                    return false;
-                
-                //Step back
-                --seq_iter;
-                
-                //Try to change previous match, repeat if necessary,
-                //otherwise resume main loop
-                sub = *seq_iter;
-                if(sub->change_match(parser, len))
-                    break;
-            }
+//Without case, letters become classes matching both cases, so the input never
+//has to be converted
+std::unique_ptr<regex_impl> regex_parser::make_char(char ch) const {
+    if(icase && lower_char(ch) != upper_char(ch)){
+        std::bitset<256> chars;
+        chars.set((unsigned char) lower_char(ch));
+        chars.set((unsigned char) upper_char(ch));
+        return std::make_unique<char_class>(chars);
+    }
+    return std::make_unique<literal>(std::string(1, ch));
+}
+
+std::unique_ptr<regex_impl> regex_parser::parse_group(){
+    ++pos;
+
+    size_t index = 0;
+    unsigned modifier = 0;
+
+    if(peek("?:"))
+        pos += 2;
+    else if(peek("?>")){
+        pos += 2;
+        modifier = regex_impl::ATOMIC;
+    }
+    else if(peek("?=")){
+        pos += 2;
+        modifier = regex_impl::LOOKAHEAD | regex_impl::FORWARDS;
+    }
+    else if(peek("?!")){
+        pos += 2;
+        modifier = regex_impl::NEG_LOOKAHEAD | regex_impl::FORWARDS;
+    }
+    else if(peek("?<=")){
+        pos += 3;
+        modifier = regex_impl::LOOKAHEAD | regex_impl::BACKWARDS;
+    }
+    else if(peek("?<!")){
+        pos += 3;
+        modifier = regex_impl::NEG_LOOKAHEAD | regex_impl::BACKWARDS;
+    }
+    else if(peek('?'))
+        error("Unknown group type");
+    else
+        index = ++groups;
+
+    auto node = parse_alternative();
+
+    if(!peek(')'))
+        error("Unterminated group, ')' expected");
+    ++pos;
+
+    if(index){
+        //Groups are innermost, so they can not be added to anything else
+        if(node->group || node->min_rep != 1 || node->max_rep != 1
+            || (node->modifier & (regex_impl::LOOKAHEAD_MODIFIER | regex_impl::ATOMIC)))
+            node = wrap(std::move(node));
+
+        node->group = index;
+    }
+    else if(modifier){
+        if(node->min_rep != 1 || node->max_rep != 1
+            || (node->modifier & (regex_impl::LOOKAHEAD_MODIFIER | regex_impl::ATOMIC)))
+            node = wrap(std::move(node));
+
+        node->modifier &= ~regex_impl::DIRECTION_MODIFIER;
+        node->modifier |= modifier;
+        if(!(modifier & regex_impl::DIRECTION_MODIFIER))
+            node->modifier |= regex_impl::FORWARDS;
+    }
+
+    return node;
+}
+
+std::unique_ptr<regex_impl> regex_parser::parse_escape(){
+    if(at_end())
+        error("Pattern ends with a lone '\\'");
+
+    char ch = pat[pos];
+
+    std::bitset<256> chars;
+    if(class_escape(ch, chars)){
+        ++pos;
+        return std::make_unique<char_class>(chars);
+    }
+
+    switch(ch){
+        case 'b':
+            ++pos;
+            return std::make_unique<assertion>(assertion::BOUNDARY);
+        case 'B':
+            ++pos;
+            return std::make_unique<assertion>(assertion::NOT_BOUNDARY);
+    }
+
+    if(ch >= '1' && ch <= '9'){
+        size_t ref = ch - '0';
+        if(ref > groups)
+            error("Reference to undefined group");
+        ++pos;
+        return std::make_unique<backreference>(ref, icase);
+    }
+
+    return make_char(parse_escaped_char());
+}
+
+char regex_parser::parse_escaped_char(){
+    char ch = pat[pos++];
+
+    switch(ch){
+        case 'n':   return '\n';
+        case 't':   return '\t';
+        case 'r':   return '\r';
+        case 'f':   return '\f';
+        case 'v':   return '\v';
+        case '0':   return '\0';
+        case 'x': {
+            if(pos + 2 > pat.length() || !std::isxdigit((unsigned char) pat[pos]) || !std::isxdigit((unsigned char) pat[pos+1]))
+                error("Invalid hexadecimal escape, two hexadecimal digits expected");
+            char hex = std::stoi(pat.substr(pos, 2), nullptr, 16);
+            pos += 2;
+            return hex;
         }
+        default:
+            return ch;
     }
-    
-    return true;
 }
-            
-bool regex::match(file_parser& parser, size_t& len){
-        
-    len = 0;
-    size_t rep_len;
-        
-    for(size_t rep = 0;; ++rep){
-        
-        if(rep >= min_reps && modifier & RELUCTANT)
+
+bool regex_parser::class_escape(char ch, std::bitset<256>& chars){
+    chars.reset();
+
+    switch(ch){
+        case 'd':   case 'D':
+            for(int c = '0'; c <= '9'; ++c)
+                chars.set(c);
             break;
-        if(rep >= max_reps)
+        case 'w':   case 'W':
+            for(int c = 0; c < 256; ++c)
+                if(std::isalnum(c) || c == '_')
+                    chars.set(c);
             break;
-        
-        if(match_single(parser, rep+1, rep_len)){
-            len += rep_len;
-            
-            //Short-circuit in case of zero-length match:
-            //it will match as many times as needed!
-            if(rep_len == 0){
-                rep = std::max(rep, min_reps);
-                break;
+        case 's':   case 'S':
+            for(char c : file_parser::whitespace)
+                chars.set((unsigned char) c);
+            break;
+        default:
+            return false;
+    }
+
+    if(std::isupper(ch))
+        chars.flip();
+
+    return true;
+}
+
+std::bitset<256> regex_parser::parse_class(){
+    std::bitset<256> chars;
+
+    bool negated = false;
+    if(peek('^')){
+        ++pos;
+        negated = true;
+    }
+
+    for(bool first = true; first || !peek(']'); first = false){
+        if(at_end())
+            error("Unterminated character class, ']' expected");
+
+        unsigned char lo;
+        if(peek('\\')){
+            ++pos;
+            if(at_end())
+                error("Unterminated character class, ']' expected");
+
+            std::bitset<256> esc;
+            if(class_escape(pat[pos], esc)){
+                ++pos;
+                chars |= esc;
+                continue;
             }
+            lo = parse_escaped_char();
         }
         else
-            break;
+            lo = pat[pos++];
+
+        unsigned char hi = lo;
+        if(peek('-') && pos + 1 < pat.length() && pat[pos+1] != ']'){
+            ++pos;
+            if(peek('\\')){
+                ++pos;
+                hi = parse_escaped_char();
+            }
+            else
+                hi = pat[pos++];
+
+            if(hi < lo)
+                error("Invalid character range");
+        }
+
+        for(unsigned c = lo; c <= hi; ++c)
+            chars.set(c);
+    }
+    ++pos;
+
+    if(icase){
+        for(unsigned c = 'a'; c <= 'z'; ++c){
+            if(chars[c] || chars[upper_char(c)]){
+                chars.set(c);
+                chars.set((unsigned char) upper_char(c));
+            }
+        }
+    }
+
+    if(negated)
+        chars.flip();
+
+    return chars;
+}
+
+bool regex_parser::plain_literal(const regex_impl& node){
+    return dynamic_cast<const literal*>(&node)
+        && node.min_rep == 1 && node.max_rep == 1 && node.group == 0
+        && !(node.modifier & (regex_impl::LOOKAHEAD_MODIFIER | regex_impl::ATOMIC));
+}
+
+std::unique_ptr<regex_impl> regex_parser::wrap(std::unique_ptr<regex_impl>&& node){
+    size_t begin = node->begin, end = node->end;
+    auto seq = std::make_unique<sequence>(std::move(node));
+    seq->begin = begin;
+    seq->end = end;
+    return seq;
+}
+
+
+
+//Compilation: every node appends its instructions to the program. When compiling
+//backwards (for lookbehind), sequences are emitted in reverse and consuming
+//instructions step backwards, so the program reads the input from right to left.
+
+bool regex_impl::nullable() const {
+    return min_rep == 0 || (modifier & LOOKAHEAD_MODIFIER) || nullable_single();
+}
+
+void regex_impl::compile(regex_program& prog, bool backwards) const {
+    size_t first = prog.code.size();
+    compile_repeated(prog, backwards);
+
+    //Whatever the nested nodes did not claim comes from this one
+    prog.origin.resize(prog.code.size(), {NPOS, NPOS});
+    for(size_t pc = first; pc < prog.code.size(); ++pc){
+        if(prog.origin[pc].first == NPOS)
+            prog.origin[pc] = {begin, end};
+    }
+}
+
+void regex_impl::compile_repeated(regex_program& prog, bool backwards) const {
+    auto& code = prog.code;
+
+    //Possessification only considers what follows a quantifier, so it does not
+    //hold when the whole pattern is compiled backwards (lookbehind contents are
+    //never possessified to begin with)
+    bool possessive = (modifier & POSSESSIVE) && !(possessified && backwards);
+
+    //Possessive unbounded repetition of single bytes is simple enough to be
+    //done by a single instruction, without any backtracking
+    std::bitset<256> chars;
+    if(possessive && max_rep == unbounded && !group
+        && !(modifier & (LOOKAHEAD_MODIFIER | ATOMIC)) && single_byte(chars)){
+        uint32_t cls = prog.classes.size();
+        prog.classes.push_back(chars);
+
+        for(size_t rep = 0; rep < min_rep; ++rep)
+            code.push_back({regex_inst::CLASS, backwards, cls, 0});
+        code.push_back({regex_inst::RUN, backwards, cls, possessified});
+        return;
+    }
+
+    //Otherwise, possessive repetition is atomic repetition
+    size_t atomic_at = code.size();
+    possessive = possessive && min_rep != max_rep;
+    if(possessive)
+        code.push_back({regex_inst::ATOMIC, backwards, possessified, 0});
+
+    bool reluctant = modifier & RELUCTANT;
+
+    //An unbounded repetition uses its last mandatory copy as the loop body
+    size_t copies = (max_rep == unbounded && min_rep > 0) ? min_rep - 1 : min_rep;
+    for(size_t rep = 0; rep < copies; ++rep)
+        compile_once(prog, backwards);
+
+    if(max_rep == unbounded){
+        //Loops whose body can match the empty string must check for progress,
+        //or they will happily repeat it forever
+        bool check = (modifier & LOOKAHEAD_MODIFIER) || nullable_single();
+        uint32_t slot = check ? prog.num_slots++ : 0;
+
+        uint32_t loop = code.size();
+        if(min_rep > 0){
+            if(check)
+                code.push_back({regex_inst::MARK, backwards, slot, 0});
+            compile_once(prog, backwards);
+
+            uint32_t split = code.size();
+            code.push_back({regex_inst::SPLIT, backwards, 0, 0});
+            if(check){
+                code.push_back({regex_inst::CHECK, backwards, slot, 0});
+                code.push_back({regex_inst::JUMP, backwards, loop, 0});
+            }
+
+            uint32_t again = check ? split + 1 : loop;
+            uint32_t out = code.size();
+            code[split].x = reluctant ? out : again;
+            code[split].y = reluctant ? again : out;
+        }
+        else{
+            code.push_back({regex_inst::SPLIT, backwards, 0, 0});
+            if(check)
+                code.push_back({regex_inst::MARK, backwards, slot, 0});
+            compile_once(prog, backwards);
+            if(check)
+                code.push_back({regex_inst::CHECK, backwards, slot, 0});
+            code.push_back({regex_inst::JUMP, backwards, loop, 0});
+
+            uint32_t out = code.size();
+            code[loop].x = reluctant ? out : loop + 1;
+            code[loop].y = reluctant ? loop + 1 : out;
+        }
     }
-    
-    if(rep < min_reps){
-        //Insufficient number of matches: remove those that were made
-        clear_attempt();
+    else if(max_rep > min_rep){
+        //Nested optional copies: (x(x(x)?)?)?
+        std::vector<uint32_t> splits;
+        for(size_t rep = min_rep; rep < max_rep; ++rep){
+            splits.push_back(code.size());
+            code.push_back({regex_inst::SPLIT, backwards, 0, 0});
+            compile_once(prog, backwards);
+        }
+
+        uint32_t out = code.size();
+        for(uint32_t split : splits){
+            code[split].x = reluctant ? out : split + 1;
+            code[split].y = reluctant ? split + 1 : out;
+        }
+    }
+
+    if(possessive){
+        code.push_back({regex_inst::END_SUB, backwards, possessified, 0});
+        code[atomic_at].y = code.size();
+    }
+}
+
+void regex_impl::compile_once(regex_program& prog, bool backwards) const {
+    auto& code = prog.code;
+
+    size_t sub_at = code.size();
+    bool sub = true;
+    if(modifier & LOOKAHEAD_MODIFIER){
+        code.push_back({regex_inst::LOOK, backwards, (modifier & NEG_LOOKAHEAD) ? 1u : 0u, 0});
+        //Lookaround has its own direction, regardless of the surrounding one
+        backwards = modifier & BACKWARDS;
+    }
+    else if(modifier & ATOMIC)
+        code.push_back({regex_inst::ATOMIC, backwards, 0, 0});
+    else
+        sub = false;
+
+    if(group)
+        code.push_back({regex_inst::SAVE, backwards, uint32_t(2*group + backwards), 0});
+
+    compile_single(prog, backwards);
+
+    if(group)
+        code.push_back({regex_inst::SAVE, backwards, uint32_t(2*group + !backwards), 0});
+
+    if(sub){
+        code.push_back({regex_inst::END_SUB, backwards, 0, 0});
+        code[sub_at].y = code.size();
+    }
+}
+
+void literal::compile_single(regex_program& prog, bool backwards) const {
+    for(size_t i = 0; i < str.length(); ++i){
+        unsigned char ch = str[backwards ? str.length() - 1 - i : i];
+        prog.code.push_back({regex_inst::CHAR, backwards, ch, 0});
+    }
+}
+
+bool literal::single_byte(std::bitset<256>& chars) const {
+    if(str.length() != 1)
         return false;
+
+    chars.reset();
+    chars.set((unsigned char) str[0]);
+    return true;
+}
+
+void char_class::compile_single(regex_program& prog, bool backwards) const {
+    prog.code.push_back({regex_inst::CLASS, backwards, uint32_t(prog.classes.size()), 0});
+    prog.classes.push_back(chars);
+}
+
+void assertion::compile_single(regex_program& prog, bool backwards) const {
+    prog.code.push_back({regex_inst::ASSERT, backwards, uint32_t(type), 0});
+}
+
+void backreference::compile_single(regex_program& prog, bool backwards) const {
+    prog.code.push_back({regex_inst::BACKREF, backwards, uint32_t(ref), icase});
+}
+
+void alternative::compile_single(regex_program& prog, bool backwards) const {
+    auto& code = prog.code;
+
+    uint32_t split = code.size();
+    code.push_back({regex_inst::SPLIT, backwards, split + 1, 0});
+    head->compile(prog, backwards);
+
+    uint32_t jump = code.size();
+    code.push_back({regex_inst::JUMP, backwards, 0, 0});
+
+    code[split].y = code.size();
+    tail->compile(prog, backwards);
+    code[jump].x = code.size();
+}
+
+void sequence::compile_single(regex_program& prog, bool backwards) const {
+    if(backwards && tail)
+        tail->compile(prog, backwards);
+
+    head->compile(prog, backwards);
+
+    if(!backwards && tail)
+        tail->compile(prog, backwards);
+}
+
+
+
+//Possessification: a greedy quantifier whose single repetition can only match
+//in one way never needs to give back a repetition if nothing that can follow
+//it starts like a repetition does, since the rest of the pattern would then
+//fail anyway.
+
+detail::regex_first regex_impl::first() const {
+    detail::regex_first first{{}, false, false};
+
+    if(modifier & LOOKAHEAD_MODIFIER){
+        first.nullable = true;
+        first.opaque = true;
+        return first;
+    }
+
+    first_single(first);
+    if(min_rep == 0)
+        first.nullable = true;
+
+    return first;
+}
+
+void regex_impl::possessify(const detail::regex_first& follow, std::vector<size_t>& converted){
+    detail::regex_first single{{}, false, false};
+    first_single(single);
+
+    if(modifier & LOOKAHEAD_MODIFIER){
+        //Lookbehind is matched backwards, so what follows it is not what follows its contents
+        if(!(modifier & BACKWARDS))
+            possessify_single({{}, true, false}, converted);
+        return;
     }
+
+    //Within a loop, a repetition may be followed by another one
+    detail::regex_first inner = follow;
+    if(max_rep > 1){
+        inner.chars |= single.chars;
+        inner.opaque |= single.opaque;
+    }
+    possessify_single(inner, converted);
+
+    if((modifier & GREEDY) && max_rep > min_rep && fixed_single()
+        && !follow.opaque && (follow.chars & single.chars).none()){
+        modifier = (modifier & ~BACKTRACK_MODIFIER) | POSSESSIVE;
+        possessified = true;
+        converted.push_back(source);
+    }
+}
+
+void literal::first_single(detail::regex_first& first) const {
+    if(str.empty())
+        first.nullable = true;
     else
-        return true;
-    
-}
-
-bool regex::change_submatch(file_parser& parser, size_t& len){
-    attempt att = attempts.top();
-    
-    //Try changing the match of the current sequence
-    for(auto seq_iter = --att.alt->end(); seq_iter != att.alt->begin(); --seq_iter){
-        if(
-            seq_iter->change_match(parser, len) 
-            && 
-            match_sequence(parser, seq_iter + 1, *att.alt, sub_len)
-        ){
-            len += sub_len;
-            att.len = len;
-            return true;
+        first.chars.set((unsigned char) str[0]);
+}
+
+void char_class::first_single(detail::regex_first& first) const {
+    first.chars = chars;
+}
+
+void assertion::first_single(detail::regex_first& first) const {
+    first.nullable = true;
+    //Giving back characters never makes the end of the input any closer
+    first.opaque = (type != END);
+}
+
+void backreference::first_single(detail::regex_first& first) const {
+    first.nullable = true;
+    first.opaque = true;
+}
+
+void alternative::first_single(detail::regex_first& first) const {
+    detail::regex_first a = head->first(), b = tail->first();
+
+    first.chars    = a.chars | b.chars;
+    first.nullable = a.nullable || b.nullable;
+    first.opaque   = a.opaque || b.opaque;
+}
+
+void alternative::possessify_single(const detail::regex_first& follow, std::vector<size_t>& converted){
+    head->possessify(follow, converted);
+    tail->possessify(follow, converted);
+}
+
+void sequence::first_single(detail::regex_first& first) const {
+    first = head->first();
+
+    if(first.nullable && tail){
+        detail::regex_first rest = tail->first();
+        first.chars   |= rest.chars;
+        first.opaque  |= rest.opaque;
+        first.nullable = rest.nullable;
+    }
+}
+
+void sequence::possessify_single(const detail::regex_first& follow, std::vector<size_t>& converted){
+    if(!tail){
+        head->possessify(follow, converted);
+        return;
+    }
+
+    detail::regex_first head_follow = tail->first();
+    if(head_follow.nullable){
+        head_follow.chars   |= follow.chars;
+        head_follow.opaque  |= follow.opaque;
+        head_follow.nullable = follow.nullable;
+    }
+
+    head->possessify(head_follow, converted);
+    tail->possessify(follow, converted);
+}
+
+
+
+//Determines which bytes can start a match, by following all paths through the
+//program that do not consume anything.
+static void find_first(const regex_program& prog, size_t pc, std::vector<bool>& visited, regex_program& out){
+    for(;;){
+        if(visited[pc])
+            return;
+        visited[pc] = true;
+
+        const regex_inst& inst = prog.code[pc];
+        switch(inst.op){
+            case regex_inst::CHAR:
+                out.first.set(inst.x);
+                return;
+            case regex_inst::CLASS:
+                out.first |= prog.classes[inst.x];
+                return;
+            case regex_inst::RUN:
+                //May match nothing, so whatever follows may come first too
+                out.first |= prog.classes[inst.x];
+                ++pc;
+                break;
+            case regex_inst::BACKREF:
+                //May be empty, and may be anything
+                out.first.set();
+                out.nullable = true;
+                return;
+            case regex_inst::MATCH:
+                out.nullable = true;
+                return;
+            case regex_inst::SPLIT:
+                find_first(prog, inst.x, visited, out);
+                pc = inst.y;
+                break;
+            case regex_inst::JUMP:
+                pc = inst.x;
+                break;
+            case regex_inst::LOOK:
+                //Zero-width: skip the sub-pattern
+                pc = inst.y;
+                break;
+            default:
+                ++pc;
+                break;
         }
     }
-    
-    auto next_alt = ++att.alt;
-    pop_alternative();
-    
-    //Try the next alternative
-    if(match_alternative(parser, next_alt, len)){
-        return true;
-    else
+}
+
+//Compiles a whole pattern in either direction. Backwards, the program starts at
+//the end of the match, so its "first" bytes are those that can end a match,
+//and it is anchored if the pattern must end at the end of the input.
+static void compile_program(const regex_impl& root, size_t groups, size_t length, bool backwards, regex_program& prog){
+    prog.num_groups = groups;
+    prog.num_slots = 2*groups;
+    root.compile(prog, backwards);
+    prog.code.push_back({regex_inst::MATCH, backwards, 0, 0});
+    prog.origin.push_back({0, length});
+
+    std::vector<bool> visited(prog.code.size(), false);
+    prog.nullable = false;
+    find_first(prog, 0, visited, prog);
+
+    prog.anchored = prog.code[0].op == regex_inst::ASSERT
+        && prog.code[0].x == (backwards ? assertion::END : assertion::BEGIN);
+
+    prog.backrefs = std::any_of(prog.code.begin(), prog.code.end(),
+                                [](const regex_inst& inst){ return inst.op == regex_inst::BACKREF; });
+}
+
+regex::regex(const std::string& pattern, size_t flags)
+ : pattern(pattern), root(), prog(), rprog(), converted(), default_stack()
+{
+    regex_parser parser(pattern, flags & icase);
+    root = parser.parse();
+
+    if(!(flags & no_possessify)){
+        root->possessify({{}, true, false}, converted);
+        std::sort(converted.begin(), converted.end());
+    }
+
+    compile_program(*root, parser.group_count(), pattern.length(), false, prog);
+    compile_program(*root, parser.group_count(), pattern.length(), true, rprog);
+}
+
+
+
+//Matching: a backtracking interpreter of the program, keeping all its state
+//in a regex_stack.
+
+std::string regex::possessified_pattern() const {
+    std::string marked = pattern;
+    for(auto it = converted.rbegin(); it != converted.rend(); ++it)
+        marked.insert(*it, 1, '+');
+    return marked;
+}
+
+void regex_stack::reset(size_t num_slots){
+    frames.clear();
+    slots.assign(num_slots, NPOS);
+    top_barrier = NPOS;
+}
+
+bool regex_stack::push(const regex_stack::frame& f){
+    if((frames.size() + 1) * sizeof(frame) > max_bytes){
+        exceeded = true;
         return false;
-    
-    //Once we have returned false, the current attempt has been popped
-}
-
-bool regex::change_match(file_parser& parser, size_t& len){
-    
-    attempt att = attempts.top();
-    size_t sub_len;
-    
-    //Try changing the number of repetitions
-    switch(modifier & BACKTRACK_MODIFIER){
-        
-        case POSSESSIVE:
+    }
+    frames.push_back(f);
+    return true;
+}
+
+static inline bool word_at(std::string_view str, size_t pos){
+    return pos < str.length() && (std::isalnum((unsigned char) str[pos]) || str[pos] == '_');
+}
+
+bool regex::run(const regex_program& prog, std::string_view str, size_t start, regex_stack& stack, size_t& end, size_t until) const {
+    if(!stack.profile || !stack.profile->covers(prog))
+        return execute<false>(prog, str, start, stack, end, until);
+
+    stack.profile->start();
+    bool found = execute<true>(prog, str, start, stack, end, until);
+    stack.profile->stop();
+    return found;
+}
+
+template<bool profiling>
+bool regex::execute(const regex_program& prog, std::string_view str, size_t start, regex_stack& stack, size_t& end, size_t until) const {
+    using frame = regex_stack::frame;
+
+    stack.reset(prog.num_slots);
+    auto& frames = stack.frames;
+    auto& slots  = stack.slots;
+
+    size_t pc  = 0;
+    size_t pos = start;
+
+    for(;;){
+        if(++stack.steps > stack.max_steps){
+            stack.exceeded = true;
             return false;
-            
-        case RELUCTANT:
-            if(att.rep >= max_reps)
-                return false;
-            
-            if(match_single(parser, att.rep + 1, sub_len)){
-                len += sub_len;
-                return true;
+        }
+
+        if constexpr (profiling)
+            stack.profile->visit(pc);
+
+        const regex_inst& inst = prog.code[pc];
+        bool ok = true;
+
+        switch(inst.op){
+            case regex_inst::CHAR:
+            case regex_inst::CLASS: {
+                if(inst.backwards ? pos == 0 : pos >= str.length()){
+                    ok = false;
+                    break;
+                }
+
+                unsigned char ch = str[inst.backwards ? pos - 1 : pos];
+                if(inst.op == regex_inst::CHAR ? ch == inst.x : prog.classes[inst.x][ch]){
+                    pos += inst.backwards ? -1 : 1;
+                    ++pc;
+                }
+                else
+                    ok = false;
+                break;
             }
-            else
-                return false;
-            
-        case GREEDY:
-            if(att.rep <= min_reps)
-                return false;
-            
-            if(type == COMPLEX){
-                //Try to change the last submatch
-                if(change_submatch(parser, len))
-                    //Match as many more as allowed given the new submatch
+
+            case regex_inst::RUN: {
+                const std::bitset<256>& chars = prog.classes[inst.x];
+                if(inst.backwards){
+                    while(pos > 0 && chars[(unsigned char) str[pos-1]])
+                        --pos;
+                }
+                else{
+                    while(pos < str.length() && chars[(unsigned char) str[pos]])
+                        ++pos;
+                }
+                ++pc;
+                break;
+            }
+
+            case regex_inst::SPLIT:
+                if(!stack.push({frame::CHOICE, inst.y, pos, 0}))
+                    return false;
+                pc = inst.x;
+                break;
+
+            case regex_inst::JUMP:
+                pc = inst.x;
+                break;
+
+            case regex_inst::SAVE:
+            case regex_inst::MARK:
+                if(!stack.push({frame::RESTORE, inst.x, slots[inst.x], 0}))
+                    return false;
+                slots[inst.x] = pos;
+                ++pc;
+                break;
+
+            case regex_inst::CHECK:
+                if(slots[inst.x] == pos)
+                    ok = false;
                 else
-                    //Let go of one repetition (destroyed by failed change_submatch), 
-                    //recursively change previous one
-                    return change_match(parser, len);
+                    ++pc;
+                break;
+
+            case regex_inst::ASSERT:
+                switch(inst.x){
+                    case assertion::BEGIN:
+                        ok = (pos == 0);
+                        break;
+                    case assertion::END:
+                        ok = (pos == str.length());
+                        break;
+                    case assertion::BOUNDARY:
+                        ok = (word_at(str, pos-1) != word_at(str, pos));
+                        break;
+                    case assertion::NOT_BOUNDARY:
+                        ok = (word_at(str, pos-1) == word_at(str, pos));
+                        break;
+                }
+                if(ok)
+                    ++pc;
+                break;
+
+            case regex_inst::BACKREF: {
+                size_t begin = slots[2*inst.x], finish = slots[2*inst.x + 1];
+                if(begin == NPOS || finish == NPOS){
+                    ok = false;
+                    break;
+                }
+
+                size_t len = finish - begin;
+                size_t at = inst.backwards ? pos - len : pos;
+                ok = inst.backwards ? pos >= len : pos + len <= str.length();
+                if(ok)
+                    ok = inst.y ? equal_icase(str.substr(at, len), str.substr(begin, len))
+                                : str.compare(at, len, str, begin, len) == 0;
+                if(ok)
+                    pos = inst.backwards ? at : pos + len;
+                if(ok)
+                    ++pc;
+                break;
             }
-            else{
-                //Simply release one attempt
-                len -= attempts.top().len;
-                pop_attempt();
+
+            case regex_inst::ATOMIC:
+            case regex_inst::LOOK:
+                if(!stack.push({frame::BARRIER, uint32_t(pc), pos, stack.top_barrier}))
+                    return false;
+                stack.top_barrier = frames.size() - 1;
+                ++pc;
+                break;
+
+            case regex_inst::END_SUB: {
+                size_t base = stack.top_barrier;
+                frame barrier = frames[base];
+                const regex_inst& opener = prog.code[barrier.a];
+                stack.top_barrier = barrier.c;
+
+                if(opener.op == regex_inst::LOOK && opener.x){
+                    //A negative lookaround matched: undo its captures and fail
+                    while(frames.size() > base){
+                        if(frames.back().kind == frame::RESTORE)
+                            slots[frames.back().a] = frames.back().b;
+                        frames.pop_back();
+                    }
+                    ok = false;
+                    break;
+                }
+
+                //Forget all choices made inside the sub-pattern, but remember
+                //how to undo its captures
+                size_t keep = base;
+                for(size_t i = base + 1; i < frames.size(); ++i){
+                    if(frames[i].kind == frame::RESTORE)
+                        frames[keep++] = frames[i];
+                }
+                frames.erase(frames.begin() + keep, frames.end());
+
+                if(opener.op == regex_inst::LOOK)
+                    pos = barrier.b;
+                ++pc;
+                break;
             }
-            
+
+            case regex_inst::MATCH:
+                if(until == NPOS || pos == until){
+                    end = pos;
+                    return true;
+                }
+                ok = false;
+                break;
+        }
+
+        //Backtrack to the most recent choice
+        if constexpr (profiling){
+            if(!ok)
+                stack.profile->backtrack(pc);
+        }
+        while(!ok){
+            if(frames.empty())
+                return false;
+
+            frame f = frames.back();
+            frames.pop_back();
+
+            switch(f.kind){
+                case frame::CHOICE:
+                    pc = f.a;
+                    pos = f.b;
+                    ok = true;
+                    break;
+                case frame::RESTORE:
+                    slots[f.a] = f.b;
+                    break;
+                case frame::BARRIER:
+                    stack.top_barrier = f.c;
+                    //A negative lookaround failed to match, so it succeeds
+                    if(prog.code[f.a].op == regex_inst::LOOK && prog.code[f.a].x){
+                        pc = prog.code[f.a].y;
+                        pos = f.b;
+                        ok = true;
+                    }
+                    break;
+            }
+        }
+    }
+}
+
+bool regex::match(std::string_view str, size_t pos, size_t& len, regex_stack& stack) const {
+    stack.steps = 0;
+    stack.exceeded = false;
+
+    if(pos > str.length())
+        return false;
+
+    size_t end;
+    if(!run(prog, str, pos, stack, end))
+        return false;
+
+    stack.slots[0] = pos;
+    stack.slots[1] = end;
+    len = end - pos;
+    return true;
+}
+
+bool regex::match_before(std::string_view str, size_t pos, size_t& len, regex_stack& stack) const {
+    stack.steps = 0;
+    stack.exceeded = false;
+
+    if(pos > str.length())
+        return false;
+
+    //The reverse program reads the match from its end to its beginning, unless
+    //it would read backreferences before their groups
+    size_t begin;
+    if(rprog.backrefs){
+        size_t end;
+        for(begin = 0; begin <= pos; ++begin){
+            if(prog.anchored && begin > 0)
+                return false;
+            if(run(prog, str, begin, stack, end, pos))
+                break;
+            if(stack.exceeded)
+                return false;
+        }
+        if(begin > pos)
+            return false;
+    }
+    else if(!run(rprog, str, pos, stack, begin))
+        return false;
+
+    stack.slots[0] = begin;
+    stack.slots[1] = pos;
+    len = pos - begin;
+    return true;
+}
+
+bool regex::search(std::string_view str, size_t pos, size_t& begin, size_t& len, regex_stack& stack) const {
+    stack.steps = 0;
+    stack.exceeded = false;
+
+    for(size_t start = pos; start <= str.length(); ++start){
+        if(prog.anchored && start > 0)
+            return false;
+
+        //Skip positions where the pattern can not possibly match
+        if(!prog.nullable){
+            while(start < str.length() && !prog.first[(unsigned char) str[start]])
+                ++start;
+            if(start == str.length())
+                return false;
+        }
+
+        size_t end;
+        if(run(prog, str, start, stack, end)){
+            stack.slots[0] = start;
+            stack.slots[1] = end;
+            begin = start;
+            len = end - start;
             return true;
+        }
+
+        if(stack.exceeded)
+            return false;
+    }
+
+    return false;
+}
+
+void regex::get_spans(const regex_stack& stack, regex_span* spans, size_t count) const {
+    for(size_t group = 0; group < count; ++group){
+        size_t begin = stack.slots[2*group], end = stack.slots[2*group + 1];
+
+        if(begin == NPOS || end == NPOS)
+            spans[group] = {NPOS, 0};
+        else
+            spans[group] = {begin, end - begin};
     }
 }
 
-bool regex::pop_attempt(){
-    size_t rep = attempts.top().rep;
-    attempts.pop();
-    return rep != 0;
+bool regex::match(file_parser& parser, size_t& len, size_t opts) const {
+    if(!match_parser(parser, len, opts, default_stack))
+        return false;
+
+    consume(parser, len, opts);
+    return true;
+}
+
+bool regex::match_parser(const file_parser& parser, size_t& len, size_t opts, regex_stack& stack) const {
+    if(opts & file_parser::backwards)
+        return match_before(parser.get_buffer(), parser.get_column(), len, stack);
+    else
+        return match(parser.get_buffer(), parser.get_column(), len, stack);
 }
 
-void regex::clear_attempt(){
-    while(pop_attempt())
-        parser.revert_to_mark( parser::remove_mark );
+std::string_view regex::parser_buffer(const file_parser& parser){
+    return parser.get_buffer();
 }
-void regex::start_attempt(){
-    attempts.push(attempt());
+size_t regex::parser_column(const file_parser& parser){
+    return parser.get_column();
 }
+void regex::move_to(file_parser& parser, size_t col){
+    parser += col - parser.get_column();
+}
+bool regex::next_line(file_parser& parser){
+    return parser.advance_line();
+}
+void regex::consume(file_parser& parser, size_t len, size_t opts){
+    if(!(opts & file_parser::consume))
+        return;
 
-void regex::attempt::~attempt(){
-    //Iterates backwards over the sequence match tried by the attempt,
-    //clearing their latest attempt as well, since it corresponds to a sub-match
-    //of this attempt.
-    for(auto iter = alt->rbegin(); iter != alt->rend(); ++iter)
-        (*iter)->clear_attempt();
+    if(opts & file_parser::backwards)
+        parser -= len;
+    else
+        parser += len;
 }
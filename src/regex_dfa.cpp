@@ -0,0 +1,516 @@
+#include "../regex_dfa.hpp"
+#include "../regex_profile.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace util;
+using detail::regex_inst;
+using detail::regex_program;
+
+static inline bool word_byte(unsigned symbol){
+    return symbol < regex_dfa::end_symbol && (std::isalnum(symbol) || symbol == '_');
+}
+
+regex_dfa::regex_dfa(const regex_program& prog, size_t opts, size_t max_bytes)
+ : prog(prog), opts(opts), max_bytes(max_bytes),
+   states(), next_state(), match_id(), index(), bytes(0), start_state(dead),
+   work(), found(), visited(prog.code.size(), 0), generation(0), key(),
+   flushes(0), misses(0), profile(nullptr)
+{
+    flush();
+    flushes = 0;
+}
+
+void regex_dfa::set_profile(regex_profile* profile){
+    this->profile = (profile && profile->covers(prog)) ? profile : nullptr;
+}
+
+bool regex_dfa::supports(const regex_program& prog){
+    for(const regex_inst& inst : prog.code){
+        switch(inst.op){
+            case regex_inst::BACKREF:
+            case regex_inst::LOOK:
+                return false;
+            case regex_inst::ATOMIC:
+            case regex_inst::END_SUB:
+                //Possessification never changes whether there is a match
+                if(!inst.x)
+                    return false;
+                break;
+            case regex_inst::RUN:
+                if(!inst.y)
+                    return false;
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+void regex_dfa::flush(){
+    ++flushes;
+    if(profile)
+        ++profile->dfa_flushes;
+
+    states.clear();
+    next_state.clear();
+    match_id.clear();
+    index.clear();
+    bytes = 0;
+
+    add_state({}, false, false);
+    start_state = add_state({0}, true, false);
+
+    //Nothing can come of the dead state, except a new line
+    for(unsigned symbol = 0; symbol < symbols; ++symbol){
+        next_state[symbol] = dead;
+        match_id[symbol] = -1;
+    }
+    if(opts & lines)
+        next_state['\n'] = start_state;
+}
+
+uint32_t regex_dfa::add_state(const std::vector<uint32_t>& pcs, bool at_begin, bool prev_word, bool matched){
+    key.assign(reinterpret_cast<const char*>(pcs.data()), pcs.size() * sizeof(uint32_t));
+    key += char(at_begin | (prev_word << 1) | (matched << 2));
+
+    auto it = index.find(key);
+    if(it != index.end())
+        return it->second;
+
+    size_t size = symbols * (sizeof(int32_t) + sizeof(int32_t)) + 2 * key.size() + sizeof(state) + 64;
+    if(bytes + size > max_bytes && states.size() > 2){
+        //Keep the new state's contents safe while everything is cleared
+        std::vector<uint32_t> keep = pcs;
+        flush();
+        return add_state(keep, at_begin, prev_word, matched);
+    }
+    bytes += size;
+
+    uint32_t s = states.size();
+    states.push_back({pcs, at_begin, prev_word, matched});
+    next_state.resize(states.size() * symbols, -1);
+    match_id.resize(states.size() * symbols, -1);
+    index.emplace(key, s);
+
+    return s;
+}
+
+//Follows all paths from the positions pcs[begin, end) of state s that do not
+//consume anything, and adds the positions after consuming the symbol to found.
+void regex_dfa::closure(size_t begin, size_t end, uint32_t s, unsigned look, int32_t& match){
+    const state& from = states[s];
+
+    //Reading backwards, the state starts at the end of the input, and the
+    //end symbol stands for its beginning
+    bool at_begin = (opts & reverse) ? look == end_symbol : from.at_begin;
+    bool at_end   = (opts & reverse) ? from.at_begin : look == end_symbol;
+
+    work.assign(from.pcs.rend() - end, from.pcs.rend() - begin);
+    while(!work.empty()){
+        uint32_t pc = work.back();
+        work.pop_back();
+
+        if(visited[pc] == generation)
+            continue;
+        visited[pc] = generation;
+
+        if(profile)
+            ++profile->insts[pc].dfa_work;
+
+        const regex_inst& inst = prog.code[pc];
+        switch(inst.op){
+            case regex_inst::CHAR:
+                if(look == inst.x)
+                    found.push_back(pc + 1);
+                break;
+            case regex_inst::CLASS:
+                if(look < end_symbol && prog.classes[inst.x][look])
+                    found.push_back(pc + 1);
+                break;
+            case regex_inst::RUN:
+                //Possessiveness never changes whether there is a match
+                if(look < end_symbol && prog.classes[inst.x][look])
+                    found.push_back(pc);
+                work.push_back(pc + 1);
+                break;
+            case regex_inst::SPLIT:
+                work.push_back(inst.y);
+                work.push_back(inst.x);
+                break;
+            case regex_inst::JUMP:
+                work.push_back(inst.x);
+                break;
+            case regex_inst::ASSERT: {
+                bool ok = false;
+                switch(inst.x){
+                    case assertion::BEGIN:
+                        ok = at_begin;
+                        break;
+                    case assertion::END:
+                        ok = at_end;
+                        break;
+                    case assertion::BOUNDARY:
+                        ok = (from.prev_word != word_byte(look));
+                        break;
+                    case assertion::NOT_BOUNDARY:
+                        ok = (from.prev_word == word_byte(look));
+                        break;
+                }
+                if(ok)
+                    work.push_back(pc + 1);
+                break;
+            }
+            case regex_inst::MATCH:
+                if(match < 0 || int32_t(inst.x) < match)
+                    match = inst.x;
+                break;
+            default:
+                //Captures and progress checks do not matter here
+                work.push_back(pc + 1);
+                break;
+        }
+    }
+}
+
+uint32_t regex_dfa::compute(uint32_t s, unsigned symbol, int32_t& match){
+    ++misses;
+    if(profile)
+        ++profile->dfa_misses;
+
+    //A newline ends the current line, and is otherwise not matched by anything
+    bool line_end = (opts & lines) && symbol == '\n';
+    unsigned look = line_end ? end_symbol : symbol;
+
+    if(++generation == 0){
+        std::fill(visited.begin(), visited.end(), 0);
+        generation = 1;
+    }
+
+    //Step each group in turn. With leftmost, a group that reaches a match
+    //makes all those after it pointless, since they started later.
+    bool leftmost = opts & regex_dfa::leftmost;
+    const std::vector<uint32_t>& pcs = states[s].pcs;
+
+    match = -1;
+    found.clear();
+    for(size_t begin = 0, end = 0; end <= pcs.size(); ++end){
+        if(end < pcs.size() && pcs[end] != mark)
+            continue;
+
+        size_t stepped = found.size();
+        closure(begin, end, s, look, match);
+        begin = end + 1;
+
+        if(leftmost){
+            std::sort(found.begin() + stepped, found.end());
+            found.push_back(mark);
+            if(match >= 0)
+                break;
+        }
+    }
+    bool matched = leftmost && (states[s].matched || match >= 0);
+
+    uint32_t to;
+    if(line_end)
+        to = start_state;
+    else if(look == end_symbol)
+        to = dead;
+    else{
+        if((opts & unanchored) && !matched)
+            found.push_back(0);
+
+        if(leftmost){
+            //Keep every position only in the earliest group reaching it,
+            //and drop the groups that end up empty
+            if(++generation == 0){
+                std::fill(visited.begin(), visited.end(), 0);
+                generation = 1;
+            }
+            size_t keep = 0;
+            for(uint32_t pc : found){
+                if(pc == mark ? keep == 0 || found[keep-1] == mark : visited[pc] == generation)
+                    continue;
+                if(pc != mark)
+                    visited[pc] = generation;
+                found[keep++] = pc;
+            }
+            found.resize(keep);
+            if(!found.empty() && found.back() == mark)
+                found.pop_back();
+        }
+        else{
+            std::sort(found.begin(), found.end());
+            found.erase(std::unique(found.begin(), found.end()), found.end());
+        }
+
+        if(found.empty())
+            to = dead;
+        else{
+            size_t before = flushes;
+            to = add_state(found, false, word_byte(look), matched);
+            //If the cache was flushed, s is gone and the transition can not be stored
+            if(flushes != before)
+                return to;
+        }
+    }
+
+    size_t t = size_t(s) * symbols + symbol;
+    next_state[t] = to;
+    match_id[t] = match;
+
+    return to;
+}
+
+bool regex_searcher::search(std::string_view str, size_t pos, size_t& begin, size_t& len){
+    if(pos > str.length())
+        return false;
+
+    //Skip positions where the pattern can not possibly match
+    if(!nullable){
+        while(pos < str.length() && !first[(unsigned char) str[pos]])
+            ++pos;
+        if(pos == str.length())
+            return false;
+    }
+
+    //Find where the leftmost-longest match ends: it is the last one reported
+    //before the automaton dies, or reaches the end
+    size_t end = std::string_view::npos;
+    int32_t match;
+
+    uint32_t s = forward.start(pos == 0, pos > 0 && word_byte((unsigned char) str[pos-1]));
+    for(size_t i = pos; i < str.length() && s != regex_dfa::dead; ++i){
+        s = forward.next(s, (unsigned char) str[i], match);
+        if(match >= 0)
+            end = i;
+    }
+    if(s != regex_dfa::dead){
+        forward.next(s, regex_dfa::end_symbol, match);
+        if(match >= 0)
+            end = str.length();
+    }
+    if(end == std::string_view::npos)
+        return false;
+
+    //Read back from there to find where the longest match ending there starts;
+    //starting before pos is not allowed, but pos may still see the byte before it
+    size_t start = end;
+    s = backward.start(end == str.length(), end < str.length() && word_byte((unsigned char) str[end]));
+    for(size_t i = end; i >= pos && s != regex_dfa::dead; --i){
+        s = backward.next(s, i > 0 ? (unsigned char) str[i-1] : regex_dfa::end_symbol, match);
+        if(match >= 0)
+            start = i;
+        if(i == pos)
+            break;
+    }
+
+    begin = start;
+    len = end - start;
+    return true;
+}
+
+bool regex_searcher::ends_at(std::string_view str, size_t pos){
+    if(pos > str.length())
+        return false;
+
+    int32_t match;
+    uint32_t s = backward.start(pos == str.length(), pos < str.length() && word_byte((unsigned char) str[pos]));
+    for(size_t i = pos; s != regex_dfa::dead; --i){
+        s = backward.next(s, i > 0 ? (unsigned char) str[i-1] : regex_dfa::end_symbol, match);
+        if(match >= 0)
+            return true;
+        if(i == 0)
+            break;
+    }
+
+    return false;
+}
+
+
+
+static void file_error(const std::string& message){
+
+#if UTIL_REGEX_ERROR_THROW
+    std::ostringstream err;
+#    define ERR_STR err
+#else
+#    define ERR_STR std::cerr
+#endif
+
+    ERR_STR << "\nERROR: " << message << "\n\n";
+
+#if UTIL_REGEX_ERROR_THROW
+    throw regex_error(err.str());
+#else
+    exit(EXIT_FAILURE);
+#endif
+
+#undef ERR_STR
+}
+
+namespace {
+    struct chunk_result {
+        std::vector< regex_file_match > matches;
+        size_t lines;
+    };
+}
+
+//Finds all matches in a single line, given as a range of the mapped file
+static void match_line(const regex& re, regex_stack& stack, const char* data,
+                       size_t begin, size_t end, size_t line, chunk_result& out){
+    std::string_view str(data + begin, end - begin);
+
+    size_t pos = 0, match_begin, match_len;
+    while(pos <= str.length() && re.search(str, pos, match_begin, match_len, stack)){
+        out.matches.push_back({{"", line, match_begin}, begin + match_begin, match_len});
+        pos = match_begin + std::max<size_t>(match_len, 1);
+    }
+}
+
+//Scans a chunk of whole lines, counting lines from zero
+static void scan_chunk(const regex& re, regex_dfa* dfa, regex_stack& stack, const char* data,
+                       size_t begin, size_t end, chunk_result& out){
+    size_t line = 0;
+    size_t line_begin = begin;
+
+    if(!dfa){
+        while(line_begin < end){
+            const char* nl = static_cast<const char*>(std::memchr(data + line_begin, '\n', end - line_begin));
+            size_t line_end = nl ? nl - data : end;
+
+            match_line(re, stack, data, line_begin, line_end, line, out);
+
+            ++line;
+            line_begin = line_end + 1;
+        }
+        out.lines = line;
+        return;
+    }
+
+    //Let the automaton reject lines without matches in a single pass, and only
+    //find the actual matches in the lines it accepts
+    uint32_t s = dfa->start();
+    int32_t match;
+    for(size_t pos = begin; pos < end; ++pos){
+        unsigned char ch = data[pos];
+        s = dfa->next(s, ch, match);
+
+        if(match >= 0){
+            const char* nl = static_cast<const char*>(std::memchr(data + pos, '\n', end - pos));
+            size_t line_end = nl ? nl - data : end;
+
+            match_line(re, stack, data, line_begin, line_end, line, out);
+
+            ++line;
+            line_begin = line_end + 1;
+            pos = line_end;
+            s = dfa->start();
+        }
+        else if(ch == '\n'){
+            ++line;
+            line_begin = pos + 1;
+        }
+    }
+
+    //The last line of the file may lack a newline
+    if(line_begin < end){
+        dfa->next(s, regex_dfa::end_symbol, match);
+        if(match >= 0)
+            match_line(re, stack, data, line_begin, end, line, out);
+        ++line;
+    }
+
+    out.lines = line;
+}
+
+std::vector< regex_file_match > util::search_file(const regex& re, const std::string& filename,
+                                                  size_t threads, const std::string& err){
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        file_error(err.empty() ? "File not found: " + filename : err);
+
+    struct stat info;
+    if(fstat(fd, &info) != 0)
+        file_error(err.empty() ? "Could not read file: " + filename : err);
+
+    size_t size = info.st_size;
+    const char* data = nullptr;
+    if(size > 0){
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map == MAP_FAILED)
+            file_error(err.empty() ? "Could not map file: " + filename : err);
+        madvise(map, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(map);
+    }
+    close(fd);
+
+    if(threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    //Several chunks per thread evens out the load, but tiny chunks are not worth it
+    const size_t min_chunk = 1 << 16;
+    size_t num_chunks = std::max<size_t>(1, std::min(threads == 1 ? 1 : 4*threads, size / min_chunk));
+
+    //Cut the file right after newlines, so that every chunk consists of whole lines
+    std::vector<size_t> bounds = {0};
+    for(size_t i = 1; i < num_chunks; ++i){
+        size_t cut = std::max(i * size / num_chunks, bounds.back());
+        const char* nl = static_cast<const char*>(std::memchr(data + cut, '\n', size - cut));
+        cut = nl ? nl - data + 1 : size;
+
+        if(cut > bounds.back() && cut < size)
+            bounds.push_back(cut);
+    }
+    bounds.push_back(size);
+    num_chunks = bounds.size() - 1;
+
+    std::vector< chunk_result > results(num_chunks);
+    std::atomic<size_t> next_chunk(0);
+    bool use_dfa = regex_dfa::supports(re);
+
+    auto worker = [&](){
+        regex_stack stack;
+        std::unique_ptr<regex_dfa> dfa;
+        if(use_dfa)
+            dfa = std::make_unique<regex_dfa>(re, regex_dfa::unanchored | regex_dfa::lines);
+
+        for(size_t chunk; (chunk = next_chunk++) < num_chunks; )
+            scan_chunk(re, dfa.get(), stack, data, bounds[chunk], bounds[chunk+1], results[chunk]);
+    };
+
+    std::vector<std::thread> pool;
+    for(size_t i = 1; i < std::min(threads, num_chunks); ++i)
+        pool.emplace_back(worker);
+    worker();
+    for(auto& thread : pool)
+        thread.join();
+
+    if(size > 0)
+        munmap(const_cast<char*>(data), size);
+
+    //Number the lines and put everything together in file order
+    std::vector< regex_file_match > matches;
+    size_t line_base = 1;
+    for(auto& result : results){
+        for(auto& match : result.matches){
+            match.source.filename = filename;
+            match.source.line += line_base;
+            matches.push_back(std::move(match));
+        }
+        line_base += result.lines;
+    }
+
+    return matches;
+}
@@ -0,0 +1,154 @@
+#include "../regex_profile.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+using namespace util;
+using detail::regex_inst;
+
+static const char* opcode_names[] = {
+    "CHAR", "CLASS", "RUN", "SPLIT", "JUMP", "SAVE", "MARK", "CHECK",
+    "ASSERT", "BACKREF", "ATOMIC", "LOOK", "END_SUB", "MATCH"
+};
+
+regex_profile::regex_profile(const regex& re)
+ : re(re), insts(re.get_program().code.size(), counters{0, 0, 0, clock::duration::zero()}),
+   runs(0), dfa_misses(0), dfa_flushes(0), last(), last_pc(std::string::npos)
+{}
+
+void regex_profile::clear(){
+    std::fill(insts.begin(), insts.end(), counters{0, 0, 0, clock::duration::zero()});
+    runs = 0;
+    dfa_misses = 0;
+    dfa_flushes = 0;
+    last_pc = std::string::npos;
+}
+
+double regex_profile::share(clock::duration time) const {
+    clock::duration total = clock::duration::zero();
+    for(const counters& inst : insts)
+        total += inst.time;
+
+    return total.count() ? double(time.count()) / total.count() : 0.0;
+}
+
+std::vector< std::pair< std::pair<size_t, size_t>, regex_profile::counters > > regex_profile::nodes() const {
+    std::map< std::pair<size_t, size_t>, counters > sums;
+
+    const auto& origin = re.get_program().origin;
+    for(size_t pc = 0; pc < insts.size(); ++pc){
+        counters& sum = sums.try_emplace(origin[pc], counters{0, 0, 0, clock::duration::zero()}).first->second;
+        sum.visits     += insts[pc].visits;
+        sum.backtracks += insts[pc].backtracks;
+        sum.dfa_work   += insts[pc].dfa_work;
+        sum.time       += insts[pc].time;
+    }
+
+    //Outer parts before the parts they contain
+    std::vector< std::pair< std::pair<size_t, size_t>, counters > > sorted(sums.begin(), sums.end());
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b){
+        return a.first.first < b.first.first
+            || (a.first.first == b.first.first && a.first.second > b.first.second);
+    });
+    return sorted;
+}
+
+std::string regex_profile::annotated() const {
+    const std::string& pattern = re.get_pattern();
+
+    size_t steps = 0;
+    for(const counters& inst : insts)
+        steps += inst.visits;
+
+    std::ostringstream out;
+    out << "Profile of \"" << pattern << "\": " << runs << " runs, " << steps << " steps";
+    if(dfa_misses || dfa_flushes)
+        out << ", " << dfa_misses << " DFA cache misses, " << dfa_flushes << " DFA flushes";
+    out << "\n\n\t" << pattern << "\n";
+
+    for(const auto& [span, sum] : nodes()){
+        const auto& [begin, end] = span;
+
+        std::string marks(begin, ' ');
+        marks += '^';
+        if(end > begin + 1)
+            marks += std::string(end - begin - 1, '~');
+        marks.resize(std::max(marks.length(), pattern.length()) + 2, ' ');
+
+        out << "\t" << marks
+            << "visits " << sum.visits
+            << ", backtracks " << sum.backtracks
+            << ", time " << std::fixed << std::setprecision(1) << 100 * share(sum.time) << "%";
+        if(sum.dfa_work)
+            out << ", DFA work " << sum.dfa_work;
+        out << "\n";
+    }
+
+    return out.str();
+}
+
+static void json_string(std::ostream& out, const std::string& str){
+    out << '"';
+    for(char ch : str){
+        switch(ch){
+            case '"':   out << "\\\"";  break;
+            case '\\':  out << "\\\\";  break;
+            case '\n':  out << "\\n";   break;
+            case '\t':  out << "\\t";   break;
+            case '\r':  out << "\\r";   break;
+            default:
+                if((unsigned char) ch < 0x20)
+                    out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(ch) << std::dec << std::setfill(' ');
+                else
+                    out << ch;
+        }
+    }
+    out << '"';
+}
+
+std::string regex_profile::json() const {
+    const std::string& pattern = re.get_pattern();
+    const auto& prog = re.get_program();
+
+    std::ostringstream out;
+    out << std::setprecision(4);
+
+    out << "{\n  \"pattern\": ";
+    json_string(out, pattern);
+    out << ",\n  \"runs\": " << runs
+        << ",\n  \"dfa_misses\": " << dfa_misses
+        << ",\n  \"dfa_flushes\": " << dfa_flushes
+        << ",\n  \"instructions\": [";
+
+    for(size_t pc = 0; pc < insts.size(); ++pc){
+        const regex_inst& inst = prog.code[pc];
+        out << (pc ? ",\n" : "\n")
+            << "    {\"pc\": " << pc
+            << ", \"op\": \"" << opcode_names[inst.op] << "\""
+            << ", \"x\": " << inst.x << ", \"y\": " << inst.y
+            << ", \"begin\": " << prog.origin[pc].first << ", \"end\": " << prog.origin[pc].second
+            << ", \"visits\": " << insts[pc].visits
+            << ", \"backtracks\": " << insts[pc].backtracks
+            << ", \"time_share\": " << share(insts[pc].time)
+            << ", \"dfa_work\": " << insts[pc].dfa_work << "}";
+    }
+
+    out << "\n  ],\n  \"nodes\": [";
+
+    bool first = true;
+    for(const auto& [span, sum] : nodes()){
+        out << (first ? "\n" : ",\n")
+            << "    {\"begin\": " << span.first << ", \"end\": " << span.second << ", \"text\": ";
+        json_string(out, pattern.substr(span.first, span.second - span.first));
+        out << ", \"visits\": " << sum.visits
+            << ", \"backtracks\": " << sum.backtracks
+            << ", \"time_share\": " << share(sum.time)
+            << ", \"dfa_work\": " << sum.dfa_work << "}";
+        first = false;
+    }
+
+    out << "\n  ]\n}\n";
+    return out.str();
+}
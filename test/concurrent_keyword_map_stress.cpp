@@ -0,0 +1,88 @@
+//Stress test of concurrent_keyword_map: several threads read the map while
+//another publishes new versions back to back, and each reader checks that
+//the version it pinned stays whole until it lets go of it. A version freed
+//too early shows up as a use-after-free or a data race.
+//
+//Build and run from this directory with
+//    g++ -std=c++17 -O1 -g -pthread -fsanitize=address -I.. concurrent_keyword_map_stress.cpp ../src/keyword_trie.cpp ../src/file_parser.cpp ../src/char_utils.cpp -o concurrent_keyword_map_stress
+//    ./concurrent_keyword_map_stress [updates]
+//or with -fsanitize=thread instead of -fsanitize=address. Exits with 1 on failure.
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../concurrent_keyword_map.hpp"
+
+namespace {
+    const size_t num_keys = 64;
+
+    std::string key(size_t i){ return "key" + std::to_string(i); }
+}
+
+int main(int argc, char** argv){
+    size_t updates = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+    size_t num_readers = std::max(2u, std::thread::hardware_concurrency());
+
+    //Every version maps all keys to its own number
+    util::keyword_map<size_t> init;
+    for(size_t i = 0; i < num_keys; ++i)
+        init[key(i)] = 0;
+    util::concurrent_keyword_map<size_t> shared(init);
+
+    std::atomic<bool> done(false);
+    std::atomic<size_t> failures(0);
+    std::atomic<size_t> reads(0);
+
+    std::vector<std::thread> readers;
+    for(size_t r = 0; r < num_readers; ++r){
+        readers.emplace_back([&, r]{
+            size_t last = 0;
+            for(size_t n = 0; !done.load(); ++n){
+                if(n % 2){
+                    size_t value = 0;
+                    if(shared.match_whole(key(n % num_keys), value) == std::string::npos || value < last)
+                        ++failures;
+                    last = value;
+                }
+                else {
+                    auto version = shared.read();
+                    size_t number = version->value(version->match_whole(key(0)).first);
+                    for(size_t i = 0; i < num_keys; ++i){
+                        auto [id, len] = version->match_whole(key((i + r) % num_keys));
+                        if(id == version->none || version->value(id) != number)
+                            ++failures;
+                    }
+                    if(number < last)
+                        ++failures;
+                    last = number;
+                }
+                ++reads;
+            }
+        });
+    }
+
+    for(size_t u = 1; u <= updates; ++u){
+        if(u % 8)
+            shared.update([u](util::keyword_map<size_t>& map){
+                for(size_t i = 0; i < num_keys; ++i)
+                    map[key(i)] = u;
+            });
+        else {
+            util::keyword_map<size_t> next;
+            for(size_t i = 0; i < num_keys; ++i)
+                next[key(i)] = u;
+            shared.replace(std::move(next));
+        }
+    }
+    done.store(true);
+    for(std::thread& reader : readers)
+        reader.join();
+
+    std::cout << updates << " updates, " << reads.load() << " reads by " << num_readers
+              << " threads, " << failures.load() << " failures\n";
+    return failures.load() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,62 @@
+//Checks that keyword_map<bool> hands out references to its values, as for
+//any other type, although a std::vector<bool> could not.
+//
+//Build and run from this directory with
+//    g++ -std=c++17 -O2 -I.. keyword_map_bool.cpp ../src/keyword_trie.cpp ../src/file_parser.cpp ../src/char_utils.cpp -o keyword_map_bool
+//    ./keyword_map_bool
+//Exits with 1 on failure.
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "../keyword_map.hpp"
+
+namespace {
+    size_t failures = 0;
+
+    void check(bool ok, const std::string& what){
+        if(!ok){
+            std::cout << "FAILED: " << what << "\n";
+            ++failures;
+        }
+    }
+}
+
+int main(){
+    util::keyword_map<bool> flags = {{"debug", false}, {"verbose", true}};
+    flags["a"] = true;
+    flags["b"];
+
+    check(flags.size() == 4, "size");
+    check(flags.value(flags.match_whole("a").first), "a set through operator[]");
+    check(!flags.value(flags.match_whole("b").first), "b default-constructed");
+    check(flags.value(flags.match_whole("verbose").first), "verbose from the list");
+
+    bool& debug = flags.value(flags.match_whole("debug").first);
+    debug = true;
+    check(flags["debug"], "debug set through a reference");
+
+    check(!flags.insert({"a", false}).second && flags["a"], "insert keeps the old value");
+
+    size_t set = 0;
+    flags.for_each([&](const std::string&, const bool& on){ set += on; });
+    check(set == 3, "for_each");
+
+    size_t found = 0;
+    flags.scan_all("a b debug x", [&](size_t, size_t, const bool& on){ found += on; });
+    check(found == 2, "scan_all");
+
+    check(flags.erase("a") && flags.match_whole("a").first == flags.none, "erase");
+    flags["c"] = true;
+    check(flags["c"] && flags.id_count() == 4, "erased id reused");
+
+    const util::keyword_map<bool>& view = flags;
+    check(view.value(view.match_whole("c").first), "const value");
+
+    auto frozen = flags.freeze();
+    check(frozen.size() == 4, "freeze");
+
+    std::cout << (failures ? "FAILED\n" : "ok\n");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,67 @@
+//Checks that matches ending at a position (match_before, and the backwards
+//option of file_parser) find the same matches as forward ones, including for
+//patterns with backreferences, which the reverse program can not read.
+//
+//Build and run from this directory with
+//    g++ -std=c++17 -O2 -I.. regex_backwards.cpp ../src/regex.cpp ../src/file_parser.cpp ../src/char_utils.cpp -o regex_backwards
+//    ./regex_backwards
+//Exits with 1 on failure.
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../file_parser.hpp"
+#include "../regex.hpp"
+
+namespace {
+    size_t failures = 0;
+
+    void check(bool ok, const std::string& what){
+        if(!ok){
+            std::cout << "FAILED: " << what << "\n";
+            ++failures;
+        }
+    }
+
+    //Whether the pattern matches str[begin, end) both forwards and backwards
+    void check_both(const std::string& pattern, const std::string& str, size_t begin, size_t end){
+        util::regex re(pattern);
+        size_t len = 0;
+        check(re.match(str, begin, len) && len == end - begin, pattern + " forwards on " + str);
+        len = 0;
+        check(re.match_before(str, end, len) && len == end - begin, pattern + " backwards on " + str);
+    }
+}
+
+int main(){
+    check_both("(a)\\1", "aa", 0, 2);
+    check_both("(a|b)x\\1", "axa", 0, 3);
+    check_both("(a|b)x\\1", "zbxb", 1, 4);
+    check_both("(\\w+) \\1", "hello hello", 0, 11);
+    check_both("(ab)\\1", "abab", 0, 4);
+    check_both("ab+c", "xabbbc", 1, 6);
+
+    size_t len;
+    util::regex pair("(a|b)x\\1");
+    check(!pair.match_before("axb", 3, len), "mismatched backreference backwards");
+    check(!pair.match_before("axa", 2, len), "match not ending at the position");
+
+    util::regex repeated("(\\w)\\1");
+    util::regex_match<2> result;
+    check(repeated.match_before("xyzz", 4, result) && result.position(0) == 2 && result[1] == "z",
+          "groups of a backwards match with a backreference");
+
+    std::istringstream in("foo axa");
+    util::file_parser parser(in);
+    parser += 7;
+    check(pair.match(parser, len, util::file_parser::backwards | util::file_parser::consume) && len == 3,
+          "file_parser::backwards with a backreference");
+    check(parser.get_column() == 4, "consumed backwards");
+
+    if(failures != 0)
+        return 1;
+    std::cout << "ok\n";
+    return 0;
+}